@@ -7,6 +7,11 @@ local packet = require("core.packet")
 local link = require("core.link")
 local ffi = require("ffi")
 local transmit, receive = link.transmit, link.receive
+local transmit_batch, receive_batch = link.transmit_batch, link.receive_batch
+local empty = link.empty
+
+-- Scratch packet arrays for batched link operations.
+local batch, copies = link.new_batch(), link.new_batch()
 
 --- # `Source` app: generate synthetic packets
 
@@ -21,8 +26,14 @@ end
 
 function Source:pull ()
    for _, o in ipairs(self.output) do
-      for i = 1, engine.pull_npackets do
-         transmit(o, packet.clone(self.packet))
+      local remaining = engine.pull_npackets
+      while remaining > 0 do
+         local n = math.min(remaining, link.max)
+         for i = 0, n - 1 do
+            batch[i] = packet.clone(self.packet)
+         end
+         transmit_batch(o, batch, n)
+         remaining = remaining - n
       end
    end
 end
@@ -40,9 +51,10 @@ function Join:new()
 end
 
 function Join:push ()
+   local output = self.output.output
    for _, inport in ipairs(self.input) do
-      while not link.empty(inport) do
-         transmit(self.output.output, receive(inport))
+      while not empty(inport) do
+         transmit_batch(output, batch, receive_batch(inport, batch, link.max))
       end
    end
 end
@@ -60,8 +72,8 @@ end
 function Split:push ()
    for _, i in ipairs(self.input) do
       for _, o in ipairs(self.output) do
-         for _ = 1, link.nreadable(i) do
-            transmit(o, receive(i))
+         while not empty(i) do
+            transmit_batch(o, batch, receive_batch(i, batch, link.max))
          end
       end
    end
@@ -77,32 +89,53 @@ end
 
 function Sink:push ()
    for _, i in ipairs(self.input) do
-      for _ = 1, link.nreadable(i) do
-        local p = receive(i)
-        packet.free(p)
+      while not empty(i) do
+         local n = receive_batch(i, batch, link.max)
+         for k = 0, n - 1 do
+            packet.free(batch[k])
+         end
       end
    end
 end
 
 --- ### `Tee` app: Send inputs to all outputs
 
-Tee = {}
+Tee = {
+   config = {
+      -- Hand every output a reference to the same packet instead of a
+      -- copy. Only safe if no app downstream modifies packets in place.
+      share = {default=false}
+   }
+}
 
-function Tee:new ()
-   return setmetatable({}, {__index=Tee})
+function Tee:new (conf)
+   return setmetatable({share=conf.share}, {__index=Tee})
 end
 
 function Tee:push ()
-   local noutputs = #self.output
+   local output = self.output
+   local noutputs = #output
    if noutputs > 0 then
+      local share = self.share
       for _, i in ipairs(self.input) do
-         for _ = 1, link.nreadable(i) do
-            local p = receive(i)
-            do local output = self.output
-               for k = 1, #output do
-                  transmit(output[k], k == #output and p or packet.clone(p))
+         while not empty(i) do
+            local n = receive_batch(i, batch, link.max)
+            if share then
+               for j = 0, n - 1 do
+                  packet.ref(batch[j], noutputs - 1)
+               end
+               for k = 1, noutputs - 1 do
+                  transmit_batch(output[k], batch, n)
+               end
+            else
+               for k = 1, noutputs - 1 do
+                  for j = 0, n - 1 do
+                     copies[j] = packet.clone(batch[j])
+                  end
+                  transmit_batch(output[k], copies, n)
                end
             end
+            transmit_batch(output[noutputs], batch, n)
          end
       end
    end
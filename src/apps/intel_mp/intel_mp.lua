@@ -508,18 +508,20 @@ function Intel:init_rx_q ()
    self.r.RDLEN(self.ndesc * ffi.sizeof(rxdesc_t))
 
    for i = 0, self.ndesc-1 do
-      local p= packet.allocate()
+      local p= packet.allocate(self.mtu)
       self.rxqueue[i]= p
       self.rxdesc[i].address= tophysical(p.data)
       self.rxdesc[i].status= 0
    end
+   -- Receive buffers are taken from the smallest packet size class that
+   -- holds an MTU sized frame. Tell the NIC their size (in KB) so that
+   -- it never writes past them.
+   local rxbuf_kb = math.floor(self.rxqueue[0].capacity / 1024)
    self.r.SRRCTL(0)
-   self.r.SRRCTL:set(bits {
-      -- Set packet buff size to 0b10000 kbytes (max)
-      BSIZEPACKET4 = 4,
+   self.r.SRRCTL:set(bor(rxbuf_kb, bits {
       -- Drop packets when no descriptors
       Drop_En = self:offset("SRRCTL", "Drop_En")
-   })
+   }))
    self:lock_sw_sem()
 
    -- enable VLAN tag stripping in VMDq mode
@@ -634,7 +636,7 @@ function Intel:push ()
    self.ingress_bandwith_alarm:check()
 
    while not empty(li) and self:can_transmit() do
-      local p = receive(li)
+      local p = packet.linearize(receive(li))
       -- NB: the comment below is taken from intel_mp.lua, which disables
       -- this check for the same reason.
       --   We must not send packets that are bigger than the MTU.  This
@@ -678,7 +680,7 @@ function Intel:pull ()
       p.length = self.rxdesc[self.rdt].length
       transmit(lo, p)
 
-      local np = packet.allocate()
+      local np = packet.allocate(self.mtu)
       self.rxqueue[self.rdt] = np
       self.rxdesc[self.rdt].address = tophysical(np.data)
       self.rxdesc[self.rdt].status = 0
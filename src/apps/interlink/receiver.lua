@@ -9,7 +9,9 @@ local Receiver = {name="apps.interlink.Receiver"}
 
 function Receiver:new (queue)
    packet.enable_group_freelist()
-   return setmetatable({attached=false, queue=queue}, {__index=Receiver})
+   return setmetatable({attached=false, queue=queue, waiting=false,
+                        batch=link.new_batch()},
+                      {__index=Receiver})
 end
 
 function Receiver:link ()
@@ -25,15 +27,39 @@ end
 
 function Receiver:pull ()
    local o, r, n = self.output.output, self.interlink, 0
+   local batch = self.batch
    if not o then return end -- don’t forward packets until connected
-   while not interlink.empty(r) and n < engine.pull_npackets do
-      link.transmit(o, interlink.extract(r))
+   if self.waiting then
+      interlink.awake(r, self.wakeup)
+      self.waiting = false
+   end
+   local max = math.min(engine.pull_npackets, link.max)
+   while not interlink.empty(r) and n < max do
+      batch[n] = interlink.extract(r)
       n = n + 1
    end
    interlink.pull(r)
+   link.transmit_batch(o, batch, n)
+end
+
+-- Let the engine block until the transmitter pushes packets.
+function Receiver:wakeup_fds ()
+   if not self.attached then return {} end
+   if not self.wakeup then
+      self.wakeup = interlink.open_wakeup(self.shm_name)
+      self.wakeup_fds_list = {self.wakeup}
+      interlink.enable_wakeup(self.interlink)
+   end
+   interlink.wait(self.interlink, self.wakeup)
+   self.waiting = true
+   return self.wakeup_fds_list
 end
 
 function Receiver:stop ()
+   if self.waiting then
+      interlink.awake(self.interlink, self.wakeup)
+   end
+   if self.wakeup then self.wakeup:close() end
    if self.attached then
       interlink.detach_receiver(self.interlink, self.shm_name)
       shm.unlink(self.backlink)
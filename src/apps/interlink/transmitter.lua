@@ -9,7 +9,9 @@ local Transmitter = {name="apps.interlink.Transmitter"}
 
 function Transmitter:new (queue)
    packet.enable_group_freelist()
-   return setmetatable({attached=false, queue=queue}, {__index=Transmitter})
+   return setmetatable({attached=false, queue=queue,
+                        batch=link.new_batch()},
+                      {__index=Transmitter})
 end
 
 function Transmitter:link ()
@@ -24,16 +26,24 @@ function Transmitter:link ()
 end
 
 function Transmitter:push ()
-   local i, r = self.input.input, self.interlink
-   while not (interlink.full(r) or link.empty(i)) do
-      local p = link.receive(i)
+   local i, r, batch = self.input.input, self.interlink, self.batch
+   local n = link.receive_batch(i, batch, interlink.nwritable(r))
+   for k = 0, n - 1 do
+      -- References are local to this process.
+      local p = packet.unshare(batch[k])
       packet.account_free(p) -- stimulate breathing
       interlink.insert(r, p)
    end
    interlink.push(r)
+   -- Only wake the receiver if it blocks on its wakeup FIFO.
+   if n > 0 and interlink.wakeup_enabled(r) then
+      self.wakeup = self.wakeup or interlink.open_wakeup(self.shm_name)
+      interlink.wakeup(r, self.wakeup)
+   end
 end
 
 function Transmitter:stop ()
+   if self.wakeup then self.wakeup:close() end
    if self.attached then
       interlink.detach_transmitter(self.interlink, self.shm_name)
       shm.unlink(self.backlink)
@@ -9,6 +9,7 @@ local bit      = require("bit")
 local ffi      = require("ffi")
 local pf       = require("pf")
 local template = require("apps.ipfix.template")
+local metadata = require("apps.rss.metadata")
 local lib      = require("core.lib")
 local link     = require("core.link")
 local packet   = require("core.packet")
@@ -150,17 +151,28 @@ function FlowSet:new (template, args)
    local avail = padded_length(mtu - ffi.sizeof(set_header_t) - max_padding)
    o.max_record_count = math.floor(avail / template.data_len)
 
+   -- Once the flow table holds cache_size flows, export and evict the
+   -- least recently seen flows (approximately) to make room for new
+   -- ones.
    local params = {
       key_type = template.key_t,
       value_type = template.value_t,
       max_occupancy_rate = 0.4,
+      aging = true,
+      evict_callback = function (ctab, entry)
+         o:debug_flow(entry, "evict")
+         -- Relying on key and value being contiguous.
+         o:add_data_record(entry.key, o.outgoing)
+      end
    }
    if args.cache_size then
       params.initial_size = math.ceil(args.cache_size / 0.4)
+      params.max_size = params.initial_size
    end
    o.table = ctable.new(params)
    o.scratch_entry = o.table.entry_type()
-   o.expiry_cursor = 0
+   o.outgoing = args.outgoing
+   o.expire_callback = function (entry) return o:expire_record(entry) end
 
    o.match = template.match
    o.incoming_link_name, o.incoming = new_internal_link('IPFIX incoming')
@@ -170,6 +182,7 @@ end
 
 function FlowSet:record_flows(timestamp)
    local entry = self.scratch_entry
+   self.table:set_time(timestamp)
    timestamp = to_milliseconds(timestamp)
    for i=1,link.nreadable(self.incoming) do
       local pkt = link.receive(self.incoming)
@@ -251,40 +264,43 @@ function FlowSet:expire_records(out, now)
    -- For a breath time of 100us, we will get 1e4 calls to push() every
    -- second.  We'd like to sweep through the flow table once every 10
    -- seconds, so on each breath we process 1e-5th of the table.
-   local cursor = self.expiry_cursor
-   local limit = cursor + math.ceil(self.table.size * 1e-5)
-   now = to_milliseconds(now)
+   self.expiry_out = out
+   self.expiry_now = to_milliseconds(now)
+   self.table:set_time(now)
+   self.table:expire(0, math.ceil(self.table.size * 1e-5),
+                     self.expire_callback)
+   self:flush_data_records(out)
+end
+
+-- Export a flow record if it is due, returning true unless it has been
+-- idle long enough to be removed.
+function FlowSet:expire_record(entry)
+   local now, out = self.expiry_now, self.expiry_out
    local active = to_milliseconds(self.active_timeout)
    local idle = to_milliseconds(self.idle_timeout)
-   while true do
-      local entry
-      cursor, entry = self.table:next_entry(cursor, limit)
-      if not entry then break end
-      if now - tonumber(entry.value.flowEndMilliseconds) > idle then
-         self:debug_flow(entry, "expire idle")
-         -- Relying on key and value being contiguous.
-         self:add_data_record(entry.key, out)
-         self.table:remove(entry.key)
-      elseif now - tonumber(entry.value.flowStartMilliseconds) > active then
-         self:debug_flow(entry, "expire active")
-         -- TODO: what should timers reset to?
-         entry.value.flowStartMilliseconds = now
-         entry.value.flowEndMilliseconds = now
-         entry.value.packetDeltaCount = 0
-         entry.value.octetDeltaCount = 0
-         self:add_data_record(entry.key, out)
-         cursor = cursor + 1
-      else
-         -- Flow still live.
-         cursor = cursor + 1
-      end
+   if now - tonumber(entry.value.flowEndMilliseconds) > idle then
+      self:debug_flow(entry, "expire idle")
+      -- Relying on key and value being contiguous.
+      self:add_data_record(entry.key, out)
+      return false
+   elseif now - tonumber(entry.value.flowStartMilliseconds) > active then
+      self:debug_flow(entry, "expire active")
+      -- TODO: what should timers reset to?
+      entry.value.flowStartMilliseconds = now
+      entry.value.flowEndMilliseconds = now
+      entry.value.packetDeltaCount = 0
+      entry.value.octetDeltaCount = 0
+      self:add_data_record(entry.key, out)
    end
-   self.expiry_cursor = cursor
-
-   self:flush_data_records(out)
+   -- Flow still live.
+   return true
 end
 
-IPFIX = {}
+IPFIX = {
+   -- Push is called even without input to expire flows and refresh
+   -- templates.
+   push_always = true
+}
 local ipfix_config_params = {
    idle_timeout = { default = 300 },
    active_timeout = { default = 120 },
@@ -332,19 +348,20 @@ function IPFIX:new(config)
    local l4_header_len = 8
    local ipfix_header_len = o.header_size
    local total_header_len = l4_header_len + l3_header_len + ipfix_header_len
+   o.outgoing_link_name, o.outgoing = new_internal_link('IPFIX outgoing')
+
    local flow_set_args = { mtu = config.mtu - total_header_len,
                            version = config.ipfix_version,
                            cache_size = config.cache_size,
                            idle_timeout = config.idle_timeout,
-                           active_timeout = config.active_timeout }
+                           active_timeout = config.active_timeout,
+                           outgoing = o.outgoing }
 
    o.flow_sets = {}
    for _, template in ipairs(config.templates) do
       table.insert(o.flow_sets, FlowSet:new(template, flow_set_args))
    end
 
-   self.outgoing_link_name, self.outgoing = new_internal_link('IPFIX outgoing')
-
    return setmetatable(o, { __index = self })
 end
 
@@ -419,8 +436,11 @@ function IPFIX:push()
    for i=1,link.nreadable(input) do
       local pkt = link.receive(input)
       local handled = false
+      -- Skip any 802.1q tag so that the filters see an untagged
+      -- frame, reusing the metadata of an app upstream if present.
+      local offset = metadata.filter_offset(metadata.get_or_add(pkt))
       for _,set in ipairs(flow_sets) do
-         if set.match(pkt.data, pkt.length) then
+         if set.match(pkt.data + offset, pkt.length - offset) then
             link.transmit(set.incoming, pkt)
             handled = true
             break
@@ -449,6 +469,12 @@ function selftest()
    local ipfix = IPFIX:new({ exporter_ip = "192.168.1.2",
                              collector_ip = "192.168.1.1",
                              collector_port = 4739 })
+   -- Each instance exports through its own internal link.
+   local other = IPFIX:new({ exporter_ip = "192.168.1.3",
+                             collector_ip = "192.168.1.1",
+                             collector_port = 4739 })
+   assert(ipfix.outgoing ~= other.outgoing)
+   assert(rawget(IPFIX, 'outgoing') == nil)
 
    -- Mock input and output.
    local input_name, input = new_internal_link('ipfix selftest input')
@@ -568,6 +594,27 @@ function selftest()
       packet.free(p)
    end
 
+   -- A full flow table exports and evicts flows to make room.
+   local flows = FlowSet:new(template.v4, { mtu = 512, version = 10,
+                                            cache_size = 10,
+                                            idle_timeout = 300,
+                                            active_timeout = 120,
+                                            outgoing = output })
+   local entry = flows.scratch_entry
+   for i = 1, 100 do
+      entry.key.sourceTransportPort = i
+      flows.table:add(entry.key, entry.value)
+   end
+   flows:flush_data_records(output)
+   assert(flows.table.occupancy == 10)
+   local exported = 0
+   for i=1,link.nreadable(output) do
+      local p = link.receive(output)
+      exported = exported + remove_record_count(p)
+      packet.free(p)
+   end
+   assert(exported == 90, "wrong number of evicted flows: "..exported)
+
    link.free(input, input_name)
    link.free(output, output_name)
 
@@ -8,6 +8,7 @@ local ffi    = require("ffi")
 local pf     = require("pf")
 local consts = require("apps.lwaftr.constants")
 local lib    = require("core.lib")
+local metadata = require("apps.rss.metadata")
 
 local ntohs  = lib.ntohs
 local htonl, htons = lib.htonl, lib.htons
@@ -154,13 +155,6 @@ end
 
 local uint16_ptr_t = ffi.typeof('uint16_t *')
 
-local function get_ipv4_ihl(l3)
-   return bit.band((l3 + o_ipv4_ver_and_ihl)[0], 0x0f)
-end
-
-local function get_ipv4_protocol(l3)    return l3[o_ipv4_proto] end
-local function get_ipv6_next_header(l3) return l3[o_ipv6_next_header] end
-
 local function get_ipv4_src_addr_ptr(l3) return l3 + o_ipv4_src_addr end
 local function get_ipv4_dst_addr_ptr(l3) return l3 + o_ipv4_dst_addr end
 
@@ -202,16 +196,15 @@ v4 = make_template_info {
 }
 
 function v4.extract(pkt, timestamp, entry)
-   local l2 = pkt.data
-   local l3 = l2 + ethernet_header_size
-   local ihl = get_ipv4_ihl(l3)
-   local l4 = l3 + ihl * 4
+   local md = metadata.get_or_add(pkt)
+   local l3 = pkt.data + md.l3_offset
+   local l4 = pkt.data + md.l4_offset
 
    -- Fill key.
    -- FIXME: Try using normal Lua assignment.
    read_ipv4_src_address(l3, entry.key.sourceIPv4Address)
    read_ipv4_dst_address(l3, entry.key.destinationIPv4Address)
-   local prot = get_ipv4_protocol(l3)
+   local prot = md.proto
    entry.key.protocolIdentifier = prot
    if prot == IP_PROTO_TCP or prot == IP_PROTO_UDP or prot == IP_PROTO_SCTP then
       entry.key.sourceTransportPort = get_tcp_src_port(l4)
@@ -226,7 +219,7 @@ function v4.extract(pkt, timestamp, entry)
    entry.value.flowEndMilliseconds = timestamp
    entry.value.packetDeltaCount = 1
    -- Measure bytes starting with the IP header.
-   entry.value.octetDeltaCount = pkt.length - ethernet_header_size
+   entry.value.octetDeltaCount = pkt.length - md.l3_offset
 end
 
 function v4.accumulate(dst, new)
@@ -263,16 +256,15 @@ v6 = make_template_info {
 }
 
 function v6.extract(pkt, timestamp, entry)
-   local l2 = pkt.data
-   local l3 = l2 + ethernet_header_size
-   -- TODO: handle chained headers
-   local l4 = l3 + ipv6_fixed_header_size
+   local md = metadata.get_or_add(pkt)
+   local l3 = pkt.data + md.l3_offset
+   local l4 = pkt.data + md.l4_offset
 
    -- Fill key.
    -- FIXME: Try using normal Lua assignment.
    read_ipv6_src_address(l3, entry.key.sourceIPv6Address)
    read_ipv6_dst_address(l3, entry.key.destinationIPv6Address)
-   local prot = get_ipv6_next_header(l3)
+   local prot = md.proto
    entry.key.protocolIdentifier = prot
    if prot == IP_PROTO_TCP or prot == IP_PROTO_UDP or prot == IP_PROTO_SCTP then
       entry.key.sourceTransportPort = get_tcp_src_port(l4)
@@ -287,7 +279,7 @@ function v6.extract(pkt, timestamp, entry)
    entry.value.flowEndMilliseconds = timestamp
    entry.value.packetDeltaCount = 1
    -- Measure bytes starting with the IP header.
-   entry.value.octetDeltaCount = pkt.length - ethernet_header_size
+   entry.value.octetDeltaCount = pkt.length - md.l3_offset
 end
 
 function v6.accumulate(dst, new)
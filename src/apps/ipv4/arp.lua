@@ -136,7 +136,10 @@ local function random_locally_administered_unicast_mac_address()
    return mac
 end
 
-ARP = {}
+ARP = {
+   -- Push is called even without input to send ARP requests.
+   push_always = true
+}
 local arp_config_params = {
    -- Source MAC address will default to a random address.
    self_mac = { default=false },
@@ -141,8 +141,8 @@ function Fragmenter:fragment_and_transmit(in_h, in_pkt)
    local offset, id = 0, self:fresh_fragment_id()
 
    while offset < total_payload_size do
-      local out_pkt = packet.allocate()
-      packet.append(out_pkt, in_pkt.data, header_size)
+      local out_pkt = packet.allocate(mtu_with_l2)
+      out_pkt = packet.append(out_pkt, in_pkt.data, header_size)
       local out_h = ffi.cast(ether_ipv4_header_ptr_t, out_pkt.data)
       local payload_size, flags = mtu_with_l2 - header_size, in_flags
       if offset + payload_size < total_payload_size then
@@ -153,7 +153,9 @@ function Fragmenter:fragment_and_transmit(in_h, in_pkt)
          payload_size = total_payload_size - offset
          flags = bit.band(flags, bit.bnot(ipv4_flag_more_fragments))
       end
-      packet.append(out_pkt, in_pkt.data + header_size + offset, payload_size)
+      out_pkt = packet.append(out_pkt, in_pkt.data + header_size + offset,
+                              payload_size)
+      out_h = ffi.cast(ether_ipv4_header_ptr_t, out_pkt.data)
       out_h.ipv4.id = htons(id)
       out_h.ipv4.total_length = htons(out_pkt.length - ether_header_len)
       out_h.ipv4.flags_and_fragment_offset = htons(
@@ -173,7 +175,7 @@ function Fragmenter:push ()
    self.outgoing_ipv4_fragments_alarm:check()
 
    for _ = 1, link.nreadable(input) do
-      local pkt = link.receive(input)
+      local pkt = packet.linearize(link.receive(input))
       local h = ffi.cast(ether_ipv4_header_ptr_t, pkt.data)
       if ntohs(h.ether.type) ~= ether_type_ipv4 then
          -- Not IPv4; forward it on.  FIXME: should make a different
@@ -21,7 +21,6 @@ local counter    = require("core.counter")
 local link       = require("core.link")
 local ipsum      = require("lib.checksum").ipsum
 local ctable     = require('lib.ctable')
-local ctablew    = require('apps.lwaftr.ctable_wrapper')
 local alarms     = require('lib.yang.alarms')
 local S          = require('syscall')
 
@@ -136,6 +135,7 @@ function Reassembler:new(conf)
    local o = lib.parse(conf, reassembler_config_params)
 
    local max_occupy = 0.9
+   local size = math.ceil(o.max_concurrent_reassemblies / max_occupy)
    local params = {
       key_type = ffi.typeof[[
          struct {
@@ -155,10 +155,15 @@ function Reassembler:new(conf)
          } __attribute((packed))]],
          o.max_fragments_per_reassembly,
          o.max_fragments_per_reassembly),
-      initial_size = math.ceil(o.max_concurrent_reassemblies / max_occupy),
+      initial_size = size,
       max_occupancy_rate = max_occupy,
+      -- When full, evict the reassembly that has gone longest without
+      -- a fragment (approximately).
+      aging = true,
+      max_size = size,
+      evict_callback = function () o:record_eviction() end
    }
-   o.ctab = ctablew.new(params)
+   o.ctab = ctable.new(params)
    o.scratch_fragment_key = params.key_type()
    o.scratch_reassembly = params.value_type()
    o.next_counter_update = -1
@@ -218,14 +223,15 @@ function Reassembler:lookup_reassembly(h, pkt)
    local headers_len = ether_header_len + ihl * 4
 
    ffi.fill(reassembly, ffi.sizeof(reassembly))
+   reassembly.packet.capacity = packet.max_payload
    reassembly.reassembly_base = headers_len
    reassembly.running_length = headers_len
-   packet.append(reassembly.packet, pkt.data, headers_len)
+   -- The packet is embedded in the reassembly record rather than taken
+   -- from a pool, so fill it in place instead of using packet.append.
+   ffi.copy(reassembly.packet.data, pkt.data, headers_len)
+   reassembly.packet.length = headers_len
 
-   local did_evict = false
-   entry, did_evict = self.ctab:add(key, reassembly, false)
-   if did_evict then self:record_eviction() end
-   return entry
+   return self.ctab:add(key, reassembly, false)
 end
 
 function Reassembler:handle_fragment(h, fragment)
@@ -302,9 +308,10 @@ function Reassembler:push ()
    local input, output = self.input.input, self.output.output
 
    self.incoming_ipv4_fragments_alarm:check()
+   self.ctab:set_time(engine.now())
 
    for _ = 1, link.nreadable(input) do
-      local pkt = link.receive(input)
+      local pkt = packet.linearize(link.receive(input))
       local h = ffi.cast(ether_ipv4_header_ptr_t, pkt.data)
       if ntohs(h.ether.type) ~= ether_type_ipv4 then
          -- Not IPv4; forward it on.  FIXME: should make a different
@@ -140,8 +140,8 @@ function Fragmenter:fragment_and_transmit(in_h, in_pkt)
    local offset, id = 0, self:fresh_fragment_id()
 
    while offset < total_payload_size do
-      local out_pkt = packet.allocate()
-      packet.append(out_pkt, in_pkt.data, ether_ipv6_header_len)
+      local out_pkt = packet.allocate(mtu_with_l2)
+      out_pkt = packet.append(out_pkt, in_pkt.data, ether_ipv6_header_len)
       local out_h = ffi.cast(ether_ipv6_header_ptr_t, out_pkt.data)
       local fragment_h = ffi.cast(fragment_header_ptr_t, out_h.ipv6.payload)
       out_pkt.length = out_pkt.length + fragment_header_len
@@ -153,8 +153,11 @@ function Fragmenter:fragment_and_transmit(in_h, in_pkt)
       else
          payload_size = total_payload_size - offset
       end
-      packet.append(out_pkt, in_pkt.data + ether_ipv6_header_len + offset,
-                    payload_size)
+      out_pkt = packet.append(out_pkt,
+                              in_pkt.data + ether_ipv6_header_len + offset,
+                              payload_size)
+      out_h = ffi.cast(ether_ipv6_header_ptr_t, out_pkt.data)
+      fragment_h = ffi.cast(fragment_header_ptr_t, out_h.ipv6.payload)
 
       out_h.ipv6.next_header = fragment_proto
       out_h.ipv6.payload_length = htons(out_pkt.length - ether_ipv6_header_len)
@@ -175,7 +178,7 @@ function Fragmenter:push ()
    self.outgoing_ipv6_fragments_alarm:check()
 
    for _ = 1, link.nreadable(input) do
-      local pkt = link.receive(input)
+      local pkt = packet.linearize(link.receive(input))
       local h = ffi.cast(ether_ipv6_header_ptr_t, pkt.data)
       if ntohs(h.ether.type) ~= ether_type_ipv6 then
          -- Not IPv6; forward it on.  FIXME: should make a different
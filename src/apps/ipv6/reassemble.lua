@@ -23,7 +23,6 @@ local counter    = require("core.counter")
 local link       = require("core.link")
 local ipsum      = require("lib.checksum").ipsum
 local ctable     = require('lib.ctable')
-local ctablew    = require('apps.lwaftr.ctable_wrapper')
 local alarms     = require('lib.yang.alarms')
 local S          = require('syscall')
 
@@ -138,6 +137,7 @@ function Reassembler:new(conf)
    local o = lib.parse(conf, reassembler_config_params)
 
    local max_occupy = 0.9
+   local size = math.ceil(o.max_concurrent_reassemblies / max_occupy)
    local params = {
       key_type = ffi.typeof[[
          struct {
@@ -157,10 +157,15 @@ function Reassembler:new(conf)
          } __attribute((packed))]],
          o.max_fragments_per_reassembly,
          o.max_fragments_per_reassembly),
-      initial_size = math.ceil(o.max_concurrent_reassemblies / max_occupy),
+      initial_size = size,
       max_occupancy_rate = max_occupy,
+      -- When full, evict the reassembly that has gone longest without
+      -- a fragment (approximately).
+      aging = true,
+      max_size = size,
+      evict_callback = function () o:record_eviction() end
    }
-   o.ctab = ctablew.new(params)
+   o.ctab = ctable.new(params)
    o.scratch_fragment_key = params.key_type()
    o.scratch_reassembly = params.value_type()
    o.next_counter_update = -1
@@ -216,15 +221,13 @@ function Reassembler:lookup_reassembly(src_ip, dst_ip, fragment_id)
 
    local reassembly = self.scratch_reassembly
    ffi.fill(reassembly, ffi.sizeof(reassembly))
+   reassembly.packet.capacity = packet.max_payload
    reassembly.reassembly_base = ether_ipv6_header_len
    reassembly.running_length = ether_ipv6_header_len
    -- Fragment 0 will fill in the contents of this data.
    packet.length = ether_ipv6_header_len
 
-   local did_evict = false
-   entry, did_evict = self.ctab:add(key, reassembly, false)
-   if did_evict then self:record_eviction() end
-   return entry
+   return self.ctab:add(key, reassembly, false)
 end
 
 function Reassembler:handle_fragment(h)
@@ -303,9 +306,10 @@ function Reassembler:push ()
    local input, output = self.input.input, self.output.output
 
    self.incoming_ipv6_fragments_alarm:check()
+   self.ctab:set_time(engine.now())
 
    for _ = 1, link.nreadable(input) do
-      local pkt = link.receive(input)
+      local pkt = packet.linearize(link.receive(input))
       local h = ffi.cast(ether_ipv6_header_ptr_t, pkt.data)
       if ntohs(h.ether.type) ~= ether_type_ipv6 then
          -- Not IPv6; forward it on.  FIXME: should make a different
@@ -19,6 +19,7 @@ local config = require("core.config")
 local counter = require("core.counter")
 
 local macaddress = require("lib.macaddress")
+local multi_copy = require("lib.multi_copy")
 
 local pcap = require("apps.pcap.pcap")
 local basic_apps = require("apps.basic.basic_apps")
@@ -75,6 +76,10 @@ local L2TPV3_NEXT_HEADER = 0x73
 
 local header_template = header_array_ctype(HEADER_SIZE)
 
+-- Writes the encapsulation header into a batch of packets.
+local copy_header = multi_copy.gen_broadcast(
+   HEADER_SIZE, ffi.offsetof("struct packet", "data"))
+
 -- fill header template with const values
 local function prepare_header_template ()
    -- all bytes are zeroed after allocation
@@ -180,7 +185,8 @@ function SimpleKeyedTunnel:new (conf)
       header = header,
       remote_address = remote_address,
       local_address = local_address,
-      remote_cookie = remote_cookie[0]
+      remote_cookie = remote_cookie[0],
+      batch = link.new_batch()
    }
 
    return setmetatable(o, {__index = SimpleKeyedTunnel})
@@ -192,12 +198,19 @@ function SimpleKeyedTunnel:push()
    local l_out = self.output.encapsulated
    assert(l_in and l_out)
 
+   local batch = self.batch
    while not link.empty(l_in) do
-      local p = link.receive(l_in)
-      p = packet.prepend(p, self.header, HEADER_SIZE)
-      local plength = ffi.cast(plength_ctype, p.data + LENGTH_OFFSET)
-      plength[0] = lib.htons(SESSION_COOKIE_SIZE + p.length - HEADER_SIZE)
-      link.transmit(l_out, p)
+      local n = link.receive_batch(l_in, batch, link.max)
+      for i = 0, n - 1 do
+         batch[i] = packet.shiftright(batch[i], HEADER_SIZE)
+      end
+      copy_header(batch, self.header, n)
+      for i = 0, n - 1 do
+         local p = batch[i]
+         local plength = ffi.cast(plength_ctype, p.data + LENGTH_OFFSET)
+         plength[0] = lib.htons(SESSION_COOKIE_SIZE + p.length - HEADER_SIZE)
+      end
+      link.transmit_batch(l_out, batch, n)
    end
 
    -- decapsulation path
@@ -84,6 +84,7 @@ function BTLookupQueue.new(binding_table)
       binding_table = assert(binding_table),
    }
    ret.streamer = binding_table.softwires:make_lookup_streamer(32)
+   ret.psid_lookup = binding_table.psid_map:make_batch_lookup(32)
    ret.packet_queue = ffi.new("struct packet * [32]")
    ret.length = 0
    return setmetatable(ret, {__index=BTLookupQueue})
@@ -103,10 +104,15 @@ end
 function BTLookupQueue:process_queue()
    if self.length > 0 then
       local streamer = self.streamer
+      local psid_lookup = self.psid_lookup
+      for n = 0, self.length-1 do
+         psid_lookup.keys[n] = streamer.entries[n].key.ipv4
+      end
+      psid_lookup:lookup()
       for n = 0, self.length-1 do
-         local ipv4 = streamer.entries[n].key.ipv4
          local port = streamer.entries[n].key.psid
-         streamer.entries[n].key.psid = self.binding_table:lookup_psid(ipv4, port)
+         streamer.entries[n].key.psid =
+            compute_psid(psid_lookup.results[n].value, port)
       end
       streamer:stream()
    end
@@ -174,8 +180,7 @@ function BindingTable:is_managed_ipv4_address(ipv4)
    return psid_info.psid_length + psid_info.shift > 0
 end
 
-function BindingTable:lookup_psid(ipv4, port)
-   local psid_info = self.psid_map:lookup(ipv4).value
+function compute_psid(psid_info, port)
    local psid_len, shift = psid_info.psid_length, psid_info.shift
    local psid_mask = lshift(1, psid_len) - 1
    local psid = band(rshift(port, shift), psid_mask)
@@ -190,6 +195,10 @@ function BindingTable:lookup_psid(ipv4, port)
    return psid
 end
 
+function BindingTable:lookup_psid(ipv4, port)
+   return compute_psid(self.psid_map:lookup(ipv4).value, port)
+end
+
 -- Iterate over the set of IPv4 addresses managed by a binding
 -- table. Invoke like:
 --
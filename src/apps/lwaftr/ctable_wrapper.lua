@@ -8,39 +8,23 @@ local bit = require("bit")
 
 local bnot, bxor = bit.bnot, bit.bxor
 local floor, ceil = math.floor, math.ceil
-local HASH_MAX = 0xFFFFFFFF
-
--- This is only called when the table is 'full'.
--- Notably, it cannot be called on an empty table,
--- so there is no risk of an infinite loop.
-local function evict_random_entry(ctab)
-   local random_hash = math.random(0, HASH_MAX - 1)
-   local index = floor(random_hash*ctab.scale + 0.5)
-   local entries = ctab.entries
-   while entries[index].hash == HASH_MAX do
-      if index >= ctab.size + ctab.max_displacement then
-         index = 0 -- Seems unreachable?
-      else
-         index = index + 1
-      end
-   end
-   local ptr = ctab.entries + index
-   ctab:remove_ptr(ptr)
-end
 
 -- Behave exactly like insertion, except if the table is full: if it
--- is, then evict a random entry instead of resizing.
+-- is, then evict a random entry instead of resizing.  Eviction is
+-- implemented by lib.ctable (see its max_size parameter); this only
+-- adds a second return value indicating whether an entry was evicted.
 local function add_with_random_eviction(self, key, value, updates_allowed)
-   local did_evict = false
-   if self.occupancy + 1 > self.occupancy_hi then
-      evict_random_entry(self)
-      did_evict = true
-   end
-   return ctable.CTable.add(self, key, value, updates_allowed), did_evict
+   self.did_evict = false
+   local entry = ctable.CTable.add(self, key, value, updates_allowed)
+   return entry, self.did_evict
 end
 
 function new(params)
-   local ctab = ctable.new(params)
+   local copy = {}
+   for k, v in pairs(params) do copy[k] = v end
+   copy.max_size = params.initial_size or 8 -- The default initial size.
+   copy.evict_callback = function (ctab) ctab.did_evict = true end
+   local ctab = ctable.new(copy)
    ctab.add = add_with_random_eviction
    return ctab
 end
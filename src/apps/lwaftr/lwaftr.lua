@@ -21,8 +21,9 @@ local alarms = require("lib.yang.alarms")
 
 local CounterAlarm = alarms.CounterAlarm
 local band, bnot = bit.band, bit.bnot
-local rshift, lshift = bit.rshift, bit.lshift
+local lshift = bit.lshift
 local receive, transmit = link.receive, link.transmit
+local receive_batch, empty = link.receive_batch, link.empty
 local rd16, wr16, rd32, wr32 = lwutil.rd16, lwutil.wr16, lwutil.rd32, lwutil.wr32
 local ipv6_equals = lwutil.ipv6_equals
 local is_ipv4, is_ipv6 = lwutil.is_ipv4, lwutil.is_ipv6
@@ -277,7 +278,8 @@ end
 
 -- initial_pkt is the one to embed (a subset of) in the ICMP payload
 function new_icmpv4_packet(from_ip, to_ip, initial_pkt, config)
-   local new_pkt = packet.allocate()
+   local new_pkt = packet.allocate(
+      ethernet_header_size + constants.max_icmpv4_packet_size)
    local dgram = to_datagram(new_pkt)
    local ipv4_header = ipv4:new({ttl = constants.default_ttl,
                                  protocol = constants.proto_icmp,
@@ -304,7 +306,8 @@ function new_icmpv4_packet(from_ip, to_ip, initial_pkt, config)
 end
 
 function new_icmpv6_packet(from_ip, to_ip, initial_pkt, config)
-   local new_pkt = packet.allocate()
+   local new_pkt = packet.allocate(
+      ethernet_header_size + constants.max_icmpv6_packet_size)
    local dgram = to_datagram(new_pkt)
    local ipv6_header = ipv6:new({hop_limit = constants.default_ttl,
                                  next_header = constants.proto_icmpv6,
@@ -426,6 +429,7 @@ function LwAftr:new(conf)
    o.binding_table = bt.load(conf.binding_table)
    o.inet_lookup_queue = bt.BTLookupQueue.new(o.binding_table)
    o.hairpin_lookup_queue = bt.BTLookupQueue.new(o.binding_table)
+   o.batch = link.new_batch()
 
    o.icmpv4_error_count = 0
    o.icmpv4_error_rate_limit_start = 0
@@ -485,21 +489,16 @@ end
 
 local function decrement_ttl(pkt)
    local ipv4_header = get_ethernet_payload(pkt)
-   local chksum = bnot(ntohs(rd16(ipv4_header + o_ipv4_checksum)))
    local old_ttl = ipv4_header[o_ipv4_ttl]
    if old_ttl == 0 then return 0 end
    local new_ttl = band(old_ttl - 1, 0xff)
    ipv4_header[o_ipv4_ttl] = new_ttl
    -- Now fix up the checksum.  o_ipv4_ttl is the first byte in the
-   -- 16-bit big-endian word, so the difference to the overall sum is
-   -- multiplied by 0xff.
-   chksum = chksum + lshift(new_ttl - old_ttl, 8)
-   -- Now do the one's complement 16-bit addition of the 16-bit words of
-   -- the checksum, which necessarily is a 32-bit value.  Two carry
-   -- iterations will suffice.
-   chksum = band(chksum, 0xffff) + rshift(chksum, 16)
-   chksum = band(chksum, 0xffff) + rshift(chksum, 16)
-   wr16(ipv4_header + o_ipv4_checksum, htons(bnot(chksum)))
+   -- 16-bit big-endian word; the protocol in the other byte is the same
+   -- before and after.
+   local chksum = ntohs(rd16(ipv4_header + o_ipv4_checksum))
+   chksum = checksum.update16(chksum, lshift(old_ttl, 8), lshift(new_ttl, 8))
+   wr16(ipv4_header + o_ipv4_checksum, htons(chksum))
    return new_ttl
 end
 
@@ -1086,51 +1085,61 @@ function LwAftr:push ()
    self.bad_ipv4_softwire_matches_alarm:check()
    self.bad_ipv6_softwire_matches_alarm:check()
 
-   for _ = 1, link.nreadable(i6) do
-      -- Decapsulate incoming IPv6 packets from the B4 interface and
-      -- push them out the V4 link, unless they need hairpinning, in
-      -- which case enqueue them on the hairpinning incoming link.
-      -- Drop anything that's not IPv6.
-      local pkt = receive(i6)
-      if is_ipv6(pkt) then
-         counter.add(self.shm["in-ipv6-bytes"], pkt.length)
-         counter.add(self.shm["in-ipv6-packets"])
-         self:from_b4(pkt)
-      else
-         counter.add(self.shm["drop-misplaced-not-ipv6-bytes"], pkt.length)
-         counter.add(self.shm["drop-misplaced-not-ipv6-packets"])
-         counter.add(self.shm["drop-all-ipv6-iface-bytes"], pkt.length)
-         counter.add(self.shm["drop-all-ipv6-iface-packets"])
-         drop(pkt)
+   local batch = self.batch
+   while not empty(i6) do
+      local npackets = receive_batch(i6, batch, link.max)
+      for n = 0, npackets - 1 do
+         -- Decapsulate incoming IPv6 packets from the B4 interface and
+         -- push them out the V4 link, unless they need hairpinning, in
+         -- which case enqueue them on the hairpinning incoming link.
+         -- Drop anything that's not IPv6.
+         local pkt = batch[n]
+         if is_ipv6(pkt) then
+            counter.add(self.shm["in-ipv6-bytes"], pkt.length)
+            counter.add(self.shm["in-ipv6-packets"])
+            self:from_b4(pkt)
+         else
+            counter.add(self.shm["drop-misplaced-not-ipv6-bytes"], pkt.length)
+            counter.add(self.shm["drop-misplaced-not-ipv6-packets"])
+            counter.add(self.shm["drop-all-ipv6-iface-bytes"], pkt.length)
+            counter.add(self.shm["drop-all-ipv6-iface-packets"])
+            drop(pkt)
+         end
       end
    end
    self:flush_decapsulation()
 
-   for _ = 1, link.nreadable(i4) do
-      -- Encapsulate incoming IPv4 packets, excluding hairpinned
-      -- packets.  Drop anything that's not IPv4.
-      local pkt = receive(i4)
-      if is_ipv4(pkt) then
-         counter.add(self.shm["in-ipv4-bytes"], pkt.length)
-         counter.add(self.shm["in-ipv4-packets"])
-         self:from_inet(pkt, PKT_FROM_INET)
-      else
-         counter.add(self.shm["drop-misplaced-not-ipv4-bytes"], pkt.length)
-         counter.add(self.shm["drop-misplaced-not-ipv4-packets"])
-         -- It's guaranteed to not be hairpinned.
-         counter.add(self.shm["drop-all-ipv4-iface-bytes"], pkt.length)
-         counter.add(self.shm["drop-all-ipv4-iface-packets"])
-         drop(pkt)
+   while not empty(i4) do
+      local npackets = receive_batch(i4, batch, link.max)
+      for n = 0, npackets - 1 do
+         -- Encapsulate incoming IPv4 packets, excluding hairpinned
+         -- packets.  Drop anything that's not IPv4.
+         local pkt = batch[n]
+         if is_ipv4(pkt) then
+            counter.add(self.shm["in-ipv4-bytes"], pkt.length)
+            counter.add(self.shm["in-ipv4-packets"])
+            self:from_inet(pkt, PKT_FROM_INET)
+         else
+            counter.add(self.shm["drop-misplaced-not-ipv4-bytes"], pkt.length)
+            counter.add(self.shm["drop-misplaced-not-ipv4-packets"])
+            -- It's guaranteed to not be hairpinned.
+            counter.add(self.shm["drop-all-ipv4-iface-bytes"], pkt.length)
+            counter.add(self.shm["drop-all-ipv4-iface-packets"])
+            drop(pkt)
+         end
       end
    end
    self:flush_encapsulation()
 
-   for _ = 1, link.nreadable(ih) do
-      -- Encapsulate hairpinned packet.
-      local pkt = receive(ih)
-      -- To reach this link, it has to have come through the lwaftr, so it
-      -- is certainly IPv4. It was already counted, no more counter updates.
-      self:from_inet(pkt, PKT_HAIRPINNED)
+   while not empty(ih) do
+      local npackets = receive_batch(ih, batch, link.max)
+      for n = 0, npackets - 1 do
+         -- Encapsulate hairpinned packet.
+         local pkt = batch[n]
+         -- To reach this link, it has to have come through the lwaftr, so it
+         -- is certainly IPv4. It was already counted, no more counter updates.
+         self:from_inet(pkt, PKT_HAIRPINNED)
+      end
    end
    self:flush_hairpin()
 end
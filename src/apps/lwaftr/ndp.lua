@@ -170,7 +170,8 @@ end
 
 local function make_ndp_packet(src_mac, dst_mac, src_ip, dst_ip, message_type,
                                message, option)
-   local pkt = packet.allocate()
+   local pkt = packet.allocate(
+      ndp_header_len + ffi.sizeof(message) + ffi.sizeof(option))
 
    pkt.length = ndp_header_len
    local h = ffi.cast(ndp_header_ptr_t, pkt.data)
@@ -190,8 +191,9 @@ local function make_ndp_packet(src_mac, dst_mac, src_ip, dst_ip, message_type,
    h.icmpv6.code = 0
    h.icmpv6.checksum = 0
 
-   packet.append(pkt, message, ffi.sizeof(message))
-   packet.append(pkt, option, ffi.sizeof(option))
+   pkt = packet.append(pkt, message, ffi.sizeof(message))
+   pkt = packet.append(pkt, option, ffi.sizeof(option))
+   h = ffi.cast(ndp_header_ptr_t, pkt.data)
 
    -- Now fix up lengths and checksums.
    h.ipv6.payload_length = htons(pkt.length - ffi.sizeof(ether_header_t)
@@ -269,7 +271,10 @@ local function random_locally_administered_unicast_mac_address()
    return mac
 end
 
-NDP = {}
+NDP = {
+   -- Push is called even without input to send neighbor solicitations.
+   push_always = true
+}
 local ndp_config_params = {
    -- Source MAC address will default to a random address.
    self_mac  = { default=false },
@@ -2,10 +2,9 @@ module(..., package.seeall)
 
 local app = require("core.app")
 local basic_apps = require("apps.basic.basic_apps")
+local checksum = require("lib.checksum")
 local constants = require("apps.lwaftr.constants")
 local ethernet = require("lib.protocol.ethernet")
-local tcp = require("lib.protocol.tcp")
-local udp = require("lib.protocol.udp")
 local ipv4 = require("lib.protocol.ipv4")
 local ipv6 = require("lib.protocol.ipv6")
 local lib = require("core.lib")
@@ -109,29 +108,17 @@ local function ipv6_cache_trigger (pkt, mac)
    local ipv6_payload_offset = ethernet_header_size + ipv6_fixed_header_size
    local ipv4_hdr = ipv4:new_from_mem(pkt.data + ipv6_payload_offset, pkt.length - ipv6_payload_offset)
    assert(ether_hdr and ipv6_hdr and ipv4_hdr)
+   local proto = ipv4_hdr:protocol()
+   assert(proto == proto_tcp or proto == proto_udp)
 
    -- VM will discard packets not matching its MAC address on the interface.
    ether_hdr:dst(mac)
    -- Set a bogus source IP address.
    ipv6_hdr:src(n_cache_src_ipv6)
 
-   -- Set random port.
-   local tcp_hdr
+   -- Set random port, updating the TCP or UDP checksum.
    local tcp_offset = ipv6_payload_offset + ipv4_hdr:ihl() * 4
-   local proto = ipv4_hdr:protocol()
-   local payload_offset
-   if proto == proto_tcp then
-      tcp_hdr = tcp:new_from_mem(pkt.data + tcp_offset, pkt.length - tcp_offset)
-      payload_offset = tcp_offset + tcp_hdr:sizeof()
-   elseif proto == proto_udp then
-      tcp_hdr = udp:new_from_mem(pkt.data + tcp_offset, pkt.length - tcp_offset)
-      payload_offset = tcp_offset + tcp_hdr:sizeof()
-   end
-   assert(tcp_hdr)
-   tcp_hdr:src_port(random_port())
-   -- Recalculate checksum.
-   ipv4_hdr:checksum()
-   tcp_hdr:checksum(pkt.data + payload_offset, pkt.length - payload_offset, ipv4_hdr)
+   checksum.set_l4_src_port(pkt.data + tcp_offset, proto, random_port())
 
    return pkt
 end
@@ -144,28 +131,16 @@ local function ipv4_cache_trigger (pkt, mac)
    local ether_hdr = ethernet:new_from_mem(pkt.data, ethernet_header_size)
    local ip_hdr = ipv4:new_from_mem(pkt.data + ethernet_header_size, pkt.length - ethernet_header_size)
    assert(ether_hdr and ip_hdr)
+   local proto = ip_hdr:protocol()
+   assert(proto == proto_tcp or proto == proto_udp)
 
    -- VM will discard packets not matching its MAC address on the interface.
    ether_hdr:dst(mac)
-   -- Set a bogus source IP address.
-   ip_hdr:src(n_cache_src_ipv4)
-   -- Set random port.
-   local tcp_hdr
+   -- Set a bogus source IP address and a random port.  Both update the
+   -- IPv4 and TCP or UDP checksums incrementally.
+   checksum.set_ipv4_src(pkt.data + ethernet_header_size, n_cache_src_ipv4)
    local tcp_offset = ethernet_header_size + (ip_hdr:ihl() * 4)
-   local proto = ip_hdr:protocol()
-   local payload_offset
-   if proto == proto_tcp then
-      tcp_hdr = tcp:new_from_mem(pkt.data + tcp_offset, pkt.length - tcp_offset)
-      payload_offset = tcp_offset + tcp_hdr:sizeof()
-   elseif proto == proto_udp then
-      tcp_hdr = udp:new_from_mem(pkt.data + tcp_offset, pkt.length - tcp_offset)
-      payload_offset = tcp_offset + tcp_hdr:sizeof()
-   end
-   assert(tcp_hdr)
-   tcp_hdr:dst_port(random_port())
-   -- Recalculate checksum.
-   ip_hdr:checksum()
-   tcp_hdr:checksum(pkt.data + payload_offset, pkt.length - payload_offset, ip_hdr)
+   checksum.set_l4_dst_port(pkt.data + tcp_offset, proto, random_port())
 
    return pkt
 end
@@ -603,8 +578,19 @@ local function test_ipv6_flow ()
    test_ipv6_service_to_vm({pkt1})
 end
 
+-- Cache triggers are rewritten incrementally, so a UDP datagram sent
+-- without a checksum still has none.
+local function verify_cache_trigger (ipv4_pkt, length)
+   local ip_hdr = ipv4:new_from_mem(ipv4_pkt, length)
+   local ihl = ip_hdr:ihl() * 4
+   if ip_hdr:protocol() == proto_udp and rd16(ipv4_pkt + ihl + 6) == 0 then
+      assert(checksum.ipsum(ipv4_pkt, ihl, 0) == 0)
+   else
+      assert(checksum.verify_packet(ipv4_pkt, length))
+   end
+end
+
 local function test_ipv4_cache_trigger (pkt)
-   local checksum = require("lib.checksum")
    local ether_dhost = "52:54:00:00:00:01"
    local refresh_packet = ipv4_cache_trigger(pkt, ethernet:pton(ether_dhost))
    local eth_hdr = ethernet:new_from_mem(refresh_packet.data, ethernet_header_size)
@@ -613,12 +599,11 @@ local function test_ipv4_cache_trigger (pkt)
    assert(eth_hdr and ip_hdr)
    assert(ip_hdr:src_eq(n_cache_src_ipv4))
    assert(ethernet:ntop(eth_hdr:dst()) == ether_dhost)
-   assert(checksum.verify_packet(refresh_packet.data + ethernet_header_size,
-      refresh_packet.length - ethernet_header_size))
+   verify_cache_trigger(refresh_packet.data + ethernet_header_size,
+      refresh_packet.length - ethernet_header_size)
 end
 
 local function test_ipv6_cache_trigger (pkt)
-   local checksum = require("lib.checksum")
    local ether_dhost = "52:54:00:00:00:01"
    local refresh_packet = ipv6_cache_trigger(pkt, ethernet:pton(ether_dhost))
    local eth_hdr = ethernet:new_from_mem(refresh_packet.data, ethernet_header_size)
@@ -630,7 +615,7 @@ local function test_ipv6_cache_trigger (pkt)
    local payload_offset = ethernet_header_size + ipv6_fixed_header_size
    local ipv4_pkt = refresh_packet.data + payload_offset
    local ipv4_pkt_length = refresh_packet.length - payload_offset
-   assert(checksum.verify_packet(ipv4_pkt, ipv4_pkt_length))
+   verify_cache_trigger(ipv4_pkt, ipv4_pkt_length)
 end
 
 local function ipv4_udp_pkt ()
@@ -3,10 +3,12 @@
 -- A range map is a map from uint32 to value.  It divides the space of
 -- uint32 values into ranges, where every key in that range has the same
 -- value.  The expectation is that you build a range map once and then
--- use it many times.  We also expect that the number of ranges ends up
--- being fairly small and will always be found in cache.  For this
--- reason, a lookup in the range map can use an optimized branchless
--- binary search.
+-- use it many times.  When the number of ranges is fairly small and
+-- will always be found in cache, a lookup in the range map uses an
+-- optimized branchless binary search.  Bigger maps use a k-ary search
+-- over a cache-friendly copy of the keys instead (see
+-- lib.binary_search), and can look up a batch of keys at once to
+-- overlap their cache misses.
 
 module(..., package.seeall)
 
@@ -18,6 +20,11 @@ local UINT32_MAX = 0xFFFFFFFF
 
 RangeMapBuilder = {}
 RangeMap = {}
+BatchLookup = {}
+
+-- Maps with at least this many entries use k-ary search, if available.
+-- Smaller maps stay in cache, and there binary search is as fast.
+kary_search_threshold = 16384
 
 local function make_entry_type(value_type)
    return ffi.typeof([[struct {
@@ -31,6 +38,16 @@ local function make_entries_type(entry_type)
    return ffi.typeof('$[?]', entry_type)
 end
 
+local function make_search(map)
+   if binary_search.kary_available and map.size >= kary_search_threshold then
+      map.kary_tree = binary_search.kary_tree(map.entries, map.size,
+                                              map.entry_type)
+      map.binary_search = binary_search.gen_kary(map.kary_tree)
+   else
+      map.binary_search = binary_search.gen(map.size, map.entry_type)
+   end
+end
+
 local function make_equal_fn(type)
    local size = ffi.sizeof(type)
    local cast = ffi.cast
@@ -131,7 +148,7 @@ function RangeMapBuilder:build(default_value)
       entries = packed_entries,
       size = range_count
    }
-   map.binary_search = binary_search.gen(map.size, map.entry_type)
+   make_search(map)
    map = setmetatable(map, { __index = RangeMap })
    return map
 end
@@ -140,6 +157,33 @@ function RangeMap:lookup(k)
    return self.binary_search(self.entries, k)
 end
 
+-- Return an object to look up WIDTH keys at a time: fill in its keys
+-- array, call its lookup method, and read the entries that lookup()
+-- would have returned from its results array.
+function RangeMap:make_batch_lookup(width)
+   local batch = {
+      map = self,
+      width = width,
+      keys = ffi.new('uint32_t[?]', width),
+      results = ffi.new(ffi.typeof('$*[?]', self.entry_type), width)
+   }
+   if self.kary_tree then
+      batch.search = binary_search.gen_kary_batch(self.kary_tree, width)
+   end
+   return setmetatable(batch, { __index = BatchLookup })
+end
+
+function BatchLookup:lookup()
+   local map, keys, results = self.map, self.keys, self.results
+   if self.search then
+      self.search(map.entries, keys, results)
+   else
+      for i = 0, self.width - 1 do
+         results[i] = map.binary_search(map.entries, keys[i])
+      end
+   end
+end
+
 function RangeMap:iterate()
    local entry = -1
    local function next_entry()
@@ -177,7 +221,7 @@ function load(stream, value_type)
    assert(header.entry_size == ffi.sizeof(map.entry_type))
    map.size = header.size
    map.entries = stream:read_array(map.entry_type, map.size)
-   map.binary_search = binary_search.gen(map.size, map.entry_type)
+   make_search(map)
    return setmetatable(map, { __index = RangeMap })
 end
 
@@ -276,6 +320,33 @@ function selftest()
    assert(map:lookup(UINT32_MAX-1).value == 99)
    assert(map:lookup(UINT32_MAX).value == 100)
 
+   -- Big maps use k-ary search.  Check it, and batched lookups, against
+   -- the ranges that went in.
+   local builder = RangeMapBuilder.new(ffi.typeof('uint32_t'))
+   for i = 1, 2e4 do builder:add_range(i * 1000, i * 1000 + 499, i) end
+   local big = builder:build(0)
+   assert(big.kary_tree or not binary_search.kary_available)
+   local function expected(k)
+      local i = math.floor(k / 1000)
+      if i >= 1 and i <= 2e4 and k % 1000 < 500 then return i end
+      return 0
+   end
+   local batch = big:make_batch_lookup(16)
+   for j = 0, 1e5 - 1 do
+      local k = math.random(0, 2.2e7)
+      assert(big:lookup(k).value == expected(k))
+      batch.keys[j % 16] = k
+      if j % 16 == 15 then
+         batch:lookup()
+         for i = 0, 15 do
+            assert(batch.results[i].value == expected(batch.keys[i]))
+         end
+      end
+   end
+   for _, k in ipairs({0, 999, 1000, 1499, 1500, 2e7 + 499, UINT32_MAX}) do
+      assert(big:lookup(k).value == expected(k))
+   end
+
    local pmu = require('lib.pmu')
    local has_pmu_counters, err = pmu.is_available()
    if not has_pmu_counters then
@@ -4,6 +4,7 @@ module(..., package.seeall)
 
 local ffi    = require("ffi")
 local lib    = require("core.lib")
+local packet = require("core.packet")
 local consts = require("apps.lwaftr.constants")
 
 local ntohs = lib.ntohs
@@ -154,6 +155,7 @@ local function traverse_extension_headers(pkt, l3, squash)
          -- The extension header has lead us out of the packet, bail
          -- out and leave the packet unmodified. The ulp returned to
          -- the caller is the next header field of the basic header.
+         ext_hdrs_size = 0
          goto exit
       end
       ipv6_ext_hdr_fn = ipv6_ext_hdr_fns[next_header]
@@ -167,11 +169,12 @@ local function traverse_extension_headers(pkt, l3, squash)
       set_ipv6_next_header(l3, ulp)
       set_ipv6_payload_length(l3, payload_length)
       ffi.C.memmove(payload, payload + ext_hdrs_size,
-                    eff_payload_length - ext_hdrs_size
-                       + ffi.sizeof(pkt_meta_data_t))
+                    eff_payload_length - ext_hdrs_size)
+      ext_hdrs_size = 0
    end
    ::exit::
-   return payload_length, ulp
+   -- The size of the extension headers that remain in the packet.
+   return payload_length, ulp, ext_hdrs_size
 end
 
 ether_header_t = ffi.typeof([[
@@ -192,119 +195,80 @@ ether_header_t = ffi.typeof([[
 ]])
 ether_header_ptr_t = ptr_to(ether_header_t)
 
-local magic_number = 0x5ABB
-
-pkt_meta_data_t = ffi.typeof([[
-   struct {
-      uint16_t magic;
-      /* Actual ethertype for single-tagged frames */
-      uint16_t ethertype;
-      /* vlan == 0 if untagged frame */
-      uint16_t vlan;
-      /* Total size, excluding the L2 header */
-      uint16_t total_length;
-      /* Pointer and length that can be passed directly to a pflua filter */
-      uint8_t *filter_start;
-      uint16_t filter_length;
-      /* Pointers to the L3 and L4 headers */
-      uint8_t *l3;
-      uint8_t *l4;
-      /* Offsets of the respective pointers relative to the
-         start of the packet.  Used to re-calculate the
-         pointers by copy() */
-      uint16_t filter_offset;
-      uint16_t l3_offset;
-      uint16_t l4_offset;
-      uint8_t proto;
-      /* Fragment offset in units of 8 bytes.  Equals 0 if not fragmented
-         or initial fragment */
-      uint8_t frag_offset;
-      /* Difference between packet length and length
-         according to the l3 header, negative if the
-         packet is truncated, == 0 if not. A positive value
-         would indicate that the packet contains some kind
-         of padding.  This should not occur under normal
-         circumstances. */
-      int16_t length_delta;
-      /* Used by the rss app */
-      uint16_t ref;
-      uint16_t hash;
-   } __attribute__((packed))
-]])
-pkt_meta_data_ptr_t = ptr_to(pkt_meta_data_t)
-
-local function md_ptr (pkt)
-   assert(ffi.C.PACKET_PAYLOAD_SIZE - pkt.length >= ffi.sizeof(pkt_meta_data_t))
-   return ffi.cast(pkt_meta_data_ptr_t, pkt.data + pkt.length)
-end
-
-local function set_pointers (md, pkt)
-   local data = pkt.data
-   md.filter_start = data + md.filter_offset
-   md.l3 = data + md.l3_offset
-   md.l4 = data + md.l4_offset
-end
+local md_l2_l3 = bit.bor(packet.md_l2, packet.md_l3)
+local md_l2_l4 = bit.bor(md_l2_l3, packet.md_l4)
+local md_keep = bit.bor(packet.md_hash, packet.md_input_port,
+                        packet.md_timestamp)
 
 function get (pkt)
-   local md = md_ptr(pkt)
-   assert(md.magic == magic_number)
+   local md = pkt.md
+   assert(bit.band(md.valid, md_l2_l3) == md_l2_l3)
    return md
 end
 
-function copy (pkt)
-   local smd = get(pkt)
-   local cpkt = packet.clone(pkt)
-   local dmd = md_ptr(cpkt)
-   ffi.copy(dmd, smd, ffi.sizeof(pkt_meta_data_t))
-   set_pointers(dmd, cpkt)
-   return cpkt
+-- Offset of the chunk of packet data that is passed to pf filters.
+-- For 802.1q tagged frames the tag is skipped.
+function filter_offset (md)
+   return md.l3_offset - ethernet_header_size
+end
+
+-- Difference between the packet length and the length of the packet
+-- according to its L3 header.
+function length_delta (pkt, md)
+   return pkt.length - md.l3_offset - md.l3_length
 end
 
 function add (pkt, rm_ext_headers, vlan_override)
    local vlan = 0
-   local filter_offset = 0
    local l3_offset = ethernet_header_size
    local hdr = ffi.cast(ether_header_ptr_t, pkt.data)
    local ethertype = lib.ntohs(hdr.ether.type)
    if ethertype == 0x8100 then
       ethertype = lib.ntohs(hdr.dot1q.type)
       vlan = bit.band(lib.ntohs(hdr.dot1q.tci), 0xFFF)
-      filter_offset = 4
-      l3_offset = l3_offset + filter_offset
+      l3_offset = l3_offset + 4
    end
 
-   local md = md_ptr(pkt)
-   md.magic = magic_number
-   md.ref = 0
+   local md = pkt.md
+   -- Only the fields that do not depend on the packet headers survive
+   -- a fresh analysis.
+   md.valid = bit.band(md.valid, md_keep)
+   md.scratch = 0
    md.ethertype = ethertype
    md.vlan = vlan_override or vlan
    md.l3_offset = l3_offset
    local l3 = pkt.data + l3_offset
 
    if ethertype == ethertype_ipv4 then
-      md.total_length = get_ipv4_total_length(l3)
+      md.valid = bit.bor(md.valid, md_l2_l4)
+      md.l3_length = get_ipv4_total_length(l3)
       md.l4_offset = l3_offset + 4 * get_ipv4_ihl(l3)
       md.frag_offset = get_ipv4_offset(l3)
       md.proto = get_ipv4_protocol(l3)
    elseif ethertype == ethertype_ipv6 then
-      -- Optionally remove all extension headers from the packet and
-      -- track the position of the metadata block
-      local payload_length, next_header =
+      -- Optionally remove all extension headers from the packet
+      local payload_length, next_header, ext_hdrs_size =
          traverse_extension_headers(pkt, l3, rm_ext_headers)
-      md = get(pkt)
-      md.total_length = payload_length + ipv6_fixed_header_size
-      md.l4_offset = l3_offset + ipv6_fixed_header_size
+      md.valid = bit.bor(md.valid, md_l2_l4)
+      md.l3_length = payload_length + ipv6_fixed_header_size
+      md.l4_offset = l3_offset + ipv6_fixed_header_size + ext_hdrs_size
       md.frag_offset = ipv6_frag_offset
       md.proto = next_header
    else
-      md.total_length = pkt.length - l3_offset
+      md.valid = bit.bor(md.valid, md_l2_l3)
+      md.l3_length = pkt.length - l3_offset
       md.l4_offset = l3_offset
+      md.frag_offset = 0
+      md.proto = 0
    end
 
-   md.filter_offset = filter_offset
-   md.filter_length = pkt.length - filter_offset
-   md.length_delta = pkt.length - l3_offset - md.total_length
-   set_pointers(md, pkt)
-
    return md
 end
+
+-- Return the metadata of pkt, analyzing the packet first unless an
+-- app upstream has already done so.
+function get_or_add (pkt)
+   local md = pkt.md
+   if bit.band(md.valid, md_l2_l3) == md_l2_l3 then return md end
+   return add(pkt)
+end
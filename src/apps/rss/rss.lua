@@ -10,11 +10,18 @@ local metadata = require("apps.rss.metadata")
 local pf       = require("pf")
 local ffi      = require("ffi")
 
-local rshift = bit.rshift
+local rshift, band, bor = bit.rshift, bit.band, bit.bor
 local receive, transmit = link.receive, link.transmit
-local nreadable = link.nreadable
+local receive_batch, transmit_batch = link.receive_batch, link.transmit_batch
+local nreadable, empty, link_max = link.nreadable, link.empty, link.max
 local free, clone = packet.free, packet.clone
-local mdadd, mdget, mdcopy = metadata.add, metadata.get, metadata.copy
+local mdadd, mdget = metadata.add, metadata.get
+local filter_offset = metadata.filter_offset
+local md_hash = packet.md_hash
+
+-- Scratch packet arrays for batched link operations.  The internal
+-- queues are default size links, whose contents fit in a batch.
+local batch, matched = link.new_batch(), link.new_batch()
 
 local transport_proto_p = {
    -- TCP
@@ -152,13 +159,14 @@ function rss:link ()
    end
 end
 
-local function hash (md)
+local function hash (p, md)
    local info = hash_info[md.ethertype]
    local hash = 0
    if info then
-      ffi.copy(info.key.addrs, md.l3 + info.addr_offset, info.addr_size)
+      ffi.copy(info.key.addrs, p.data + md.l3_offset + info.addr_offset,
+               info.addr_size)
       if transport_proto_p[md.proto] then
-         info.key.ports = ffi.cast("uint32_t *", md.l4)[0]
+         info.key.ports = ffi.cast("uint32_t *", p.data + md.l4_offset)[0]
       else
          info.key.ports = 0
       end
@@ -168,11 +176,12 @@ local function hash (md)
       hash = rshift(info.hash_fn(info.key), 1)
    end
    md.hash = hash
+   md.valid = bor(md.valid, md_hash)
 end
 
 local function distribute (p, links, hash)
    -- This relies on the hash being a 16-bit value
-   local index = rshift(hash * links.n, 16) + 1
+   local index = rshift(band(hash, 0xffff) * links.n, 16) + 1
    transmit(links[index], p)
 end
 
@@ -181,12 +190,14 @@ function rss:push ()
 
    for _, input in ipairs(self.input_tagged) do
       local link, vlan = input.link, input.vlan
-      local npackets = nreadable(link)
-      self.rxpackets = self.rxpackets + npackets
-      for _ = 1, npackets do
-         local p = receive(link)
-         hash(mdadd(p, self.rm_ext_headers, vlan))
-         transmit(queue, p)
+      while not empty(link) do
+         local npackets = receive_batch(link, batch, link_max)
+         self.rxpackets = self.rxpackets + npackets
+         for i = 0, npackets - 1 do
+            local p = batch[i]
+            hash(p, mdadd(p, self.rm_ext_headers, vlan))
+         end
+         transmit_batch(queue, batch, npackets)
       end
    end
 
@@ -195,37 +206,51 @@ function rss:push ()
       -- put on the class' input queue.  If the class is of type
       -- "continue" or the packet doesn't match the filter, it is put
       -- back onto the main queue for inspection by the next class.
-      for _ = 1, nreadable(queue) do
-         local p = receive(queue)
+      -- Packets that go back onto the main queue are compacted in
+      -- place at the front of the batch.
+      local npackets = receive_batch(queue, batch, nreadable(queue))
+      local nmatched, nrequeue = 0, 0
+      for i = 0, npackets - 1 do
+         local p = batch[i]
          local md = mdget(p)
-         if class.match_fn(md.filter_start, md.filter_length) then
-            md.ref = md.ref + 1
-            transmit(class.input, p)
+         local offset = filter_offset(md)
+         if class.match_fn(p.data + offset, p.length - offset) then
+            -- The scratch field counts the classes matching the packet.
+            md.scratch = md.scratch + 1
+            matched[nmatched] = p
+            nmatched = nmatched + 1
             if class.continue then
-               transmit(queue, p)
+               batch[nrequeue] = p
+               nrequeue = nrequeue + 1
             end
          else
-            transmit(queue, p)
+            batch[nrequeue] = p
+            nrequeue = nrequeue + 1
          end
       end
+      transmit_batch(class.input, matched, nmatched)
+      transmit_batch(queue, batch, nrequeue)
    end
 
-   for _ = 1, nreadable(queue) do
-      local p = receive(queue)
+   local npackets = receive_batch(queue, batch, nreadable(queue))
+   for i = 0, npackets - 1 do
+      local p = batch[i]
       local md = mdget(p)
-      if md.ref == 0 then
+      if md.scratch == 0 then
          self.rxdrops_filter = self.rxdrops_filter + 1
          free(p)
       end
    end
 
    for _, class in ipairs(self.classes_active) do
-      for _ = 1, nreadable(class.input) do
-         local p = receive(class.input)
+      local npackets = receive_batch(class.input, batch,
+                                     nreadable(class.input))
+      for i = 0, npackets - 1 do
+         local p = batch[i]
          local md  = mdget(p)
-         if md.ref > 1 then
-            md.ref = md.ref - 1
-            distribute(mdcopy(p), class.output, md.hash)
+         if md.scratch > 1 then
+            md.scratch = md.scratch - 1
+            distribute(clone(p), class.output, md.hash)
          else
             distribute(p, class.output, md.hash)
          end
@@ -337,19 +362,19 @@ function selftest ()
                    md.ethertype)
             assert(md.vlan == 0 or md.vlan == vlan_id)
             local offset = md.vlan == 0 and 0 or 4
-            assert(md.filter_offset == offset, md.filter_offset)
-            assert(md.filter_start == p.data + offset)
-            assert(md.l3 == p.data + 14 + offset)
-            assert(md.total_length == p.length - 14 - offset)
-            assert(md.filter_length == p.length - offset)
+            assert(metadata.filter_offset(md) == offset)
+            assert(md.l3_offset == 14 + offset)
+            assert(md.l3_length == p.length - 14 - offset)
             if md.ethertype == 0x0800 then
-               assert(md.l4 == md.l3 + 20)
+               assert(md.l4_offset == md.l3_offset + 20)
             else
-               assert(md.l4 == md.l3 + 40)
+               assert(md.l4_offset == md.l3_offset + 40)
             end
+            assert(band(md.valid, packet.md_l4) ~= 0)
+            assert(band(md.valid, md_hash) ~= 0)
             assert(md.proto == 17)
             assert(md.frag_offset == 0)
-            assert(md.length_delta == 0, md.length_delta)
+            assert(metadata.length_delta(p, md) == 0)
             packet.free(p)
          end
       end
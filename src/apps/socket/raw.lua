@@ -79,14 +79,19 @@ function RawSocket:receive ()
    if ethernet:is_bcast(p.data) then
       counter.add(self.shm.rxbcast)
    end
-   return packet.clone(p)
+   -- Copy the frame to a packet of the smallest size class it fits.
+   return packet.from_pointer(p.data, sz)
+end
+
+function RawSocket:wakeup_fds ()
+   return {self.sock}
 end
 
 function RawSocket:push ()
    local l = self.input.rx
    if l == nil then return end
    while not link.empty(l) and self:can_transmit() do
-      local p = link.receive(l)
+      local p = packet.linearize(link.receive(l))
       self:transmit(p)
       counter.add(self.shm.txbytes, p.length)
       counter.add(self.shm.txpackets)
@@ -137,12 +137,16 @@ function Tap:new (conf)
                 .. mtu_configured)
    end
 
+   -- Frames read from the device are at most its MTU plus an Ethernet
+   -- header with a VLAN tag.
+   local rx_size = mtu_eff + 18
    return setmetatable({fd = fd,
                         sock = sock,
                         ifr = ifr,
                         name = conf.name,
                         status_timer = lib.throttle(0.001),
-                        pkt = packet.allocate(),
+                        rx_size = rx_size,
+                        pkt = packet.allocate(rx_size),
                         shm = { rxbytes   = {counter},
                                 rxpackets = {counter},
                                 rxmcast   = {counter},
@@ -170,7 +174,7 @@ function Tap:pull ()
       self:status()
    end
    for i=1,engine.pull_npackets do
-      local len, err = S.read(self.fd, self.pkt.data, C.PACKET_PAYLOAD_SIZE)
+      local len, err = S.read(self.fd, self.pkt.data, self.pkt.capacity)
       -- errno == EAGAIN indicates that the read would have blocked as there is no
       -- packet waiting. It is not a failure.
       if not len and err.errno == const.E.AGAIN then
@@ -189,16 +193,22 @@ function Tap:pull ()
       if ethernet:is_bcast(self.pkt.data) then
          counter.add(self.shm.rxbcast)
       end
-      self.pkt = packet.allocate()
+      self.pkt = packet.allocate(self.rx_size)
    end
 end
 
+-- The tap device becomes readable when a packet arrives.
+function Tap:wakeup_fds ()
+   return {self.fd}
+end
+
 function Tap:push ()
    local l = self.input.input
    while not link.empty(l) do
       -- The write might have blocked so don't dequeue the packet from the link
       -- until the write has completed.
       local p = link.front(l)
+      assert(p.next == nil, "multi-segment packets are not supported")
       local len, err = S.write(self.fd, p.data, p.length)
       -- errno == EAGAIN indicates that the write would of blocked
       if not len and err.errno ~= const.E.AGAIN or len and len ~= p.length then
@@ -46,7 +46,8 @@ function VhostUser:new (args)
    self = setmetatable(o, {__index = VhostUser})
    self.dev = net_device.VirtioNetDevice:new(self,
                                              args.disable_mrg_rxbuf,
-                                             args.disable_indirect_desc)
+                                             args.disable_indirect_desc,
+                                             args.chain_rx)
    if args.is_server then
       self.listen_socket = C.vhost_user_listen(self.socket_path)
       assert(self.listen_socket >= 0)
@@ -77,11 +78,18 @@ function VhostUser:pull ()
       self:connect()
    else
       if self.vhost_ready then
+         if self.dev.rx_waiting then self.dev:rx_awake() end
          self.dev:poll_vring_receive()
       end
    end
 end
 
+-- Let the engine block until the guest transmits.
+function VhostUser:wakeup_fds ()
+   if self.vhost_ready then return self.dev:rx_wait() end
+   return {}
+end
+
 function VhostUser:push ()
    if self.vhost_ready then
       self.dev:poll_vring_transmit()
@@ -17,13 +17,15 @@ Tagger = {
    config = {
       encapsulation = default_encap,
       tag = { required = true }
-   }
+   },
+   fusable = true
 }
 Untagger = {
    config = {
       encapsulation = default_encap,
       tag = { required = true }
-   }
+   },
+   fusable = true
 }
 VlanMux = {
    config = {
@@ -53,12 +55,15 @@ function pop_tag (pkt)
 end
 
 -- push a VLAN tag onto a packet.  The tag is in network byte-order.
+-- Returns the tagged packet, which is a different packet if the tag did
+-- not fit into the capacity of the original.
 function push_tag (pkt, tag)
-   local payload = pkt.data + o_ethernet_ethertype
    local length = pkt.length
-   pkt.length = length + 4
+   pkt = packet.resize(pkt, length + 4)
+   local payload = pkt.data + o_ethernet_ethertype
    C.memmove(payload + 4, payload, length - o_ethernet_ethertype)
    cast(uint32_ptr_t, payload)[0] = tag
+   return pkt
 end
 
 -- extract TCI (2 bytes) from packet, no check is performed to verify that the
@@ -97,13 +102,12 @@ function Tagger:new (conf)
    return(o)
 end
 
-function Tagger:push ()
+function Tagger:push (limit)
    local input, output = self.input.input, self.output.output
    local tag = self.tag
-   for _=1,link.nreadable(input) do
-      local pkt = receive(input)
-      push_tag(pkt, tag)
-      transmit(output, pkt)
+   for _=1,math.min(link.nreadable(input), limit or math.huge) do
+      local pkt = packet.unshare(receive(input))
+      transmit(output, push_tag(pkt, tag))
    end
 end
 
@@ -114,11 +118,11 @@ function Untagger:new (conf)
    return(o)
 end
 
-function Untagger:push ()
+function Untagger:push (limit)
    local input, output = self.input.input, self.output.output
    local tag = self.tag
-   for _=1,link.nreadable(input) do
-      local pkt = receive(input)
+   for _=1,math.min(link.nreadable(input), limit or math.huge) do
+      local pkt = packet.unshare(receive(input))
       local payload = pkt.data + o_ethernet_ethertype
       if cast(uint32_ptr_t, payload)[0] ~= tag then
          -- Incorrect VLAN tag; drop.
@@ -158,7 +162,7 @@ function VlanMux:push ()
    local l_in = self.input.trunk
    assert(l_in)
    while not empty(l_in) do
-      local p = receive(l_in)
+      local p = packet.unshare(receive(l_in))
       local ethertype = cast("uint16_t*", p.data
                                 + o_ethernet_ethertype)[0]
       if ethertype == htons(tpid) then
@@ -178,9 +182,8 @@ function VlanMux:push ()
       local from = from[i]
       local l_in = from.link
       while not empty(l_in) do
-         local p = receive(l_in)
-         push_tag(p, build_tag(from.vid, tpid))
-         self:transmit(l_out, p)
+         local p = packet.unshare(receive(l_in))
+         self:transmit(l_out, push_tag(p, build_tag(from.vid, tpid)))
       end
       i = i + 1
    end
@@ -212,17 +215,28 @@ function test_tag_untag ()
       26 27 28 29 2a 2b 2c 2d 2e 2f 30 31 32 33 34 35
       36 37
    ]], 82))
-   local payload = pkt.data + o_ethernet_ethertype
    local vid = 0
    for i=0,15 do
       for j=0,255 do
          local tag = build_tag(vid, tpids.dot1q)
-         push_tag(pkt, tag)
-         assert(cast(uint32_ptr_t, payload)[0] == tag)
+         pkt = push_tag(pkt, tag)
+         assert(pkt.length == 86)
+         assert(cast(uint32_ptr_t, pkt.data + o_ethernet_ethertype)[0] == tag)
+         assert(extract_tci(pkt) == vid)
+         pop_tag(pkt)
+         assert(pkt.length == 82)
          vid = vid + 1
       end
    end
    assert(vid == 4096)
+   -- Tagging a packet that fills its capacity moves it to a larger one.
+   local full = packet.resize(packet.allocate(1), 2048)
+   assert(full.capacity == 2048)
+   full = push_tag(full, build_tag(1, tpids.dot1q))
+   assert(full.capacity > 2048 and full.length == 2052)
+   assert(extract_tci(full) == 1)
+   packet.free(full)
+   packet.free(pkt)
    print("Sucessfully tagged/untagged all potential VLAN tags (0-4095)")
 end
 
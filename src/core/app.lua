@@ -10,6 +10,8 @@ local timer     = require("core.timer")
 local shm       = require("core.shm")
 local histogram = require('core.histogram')
 local counter   = require("core.counter")
+local rdtsc     = require("lib.tsc").rdtsc
+local capture   = require("lib.capture")
 local zone      = require("jit.zone")
 local jit       = require("jit")
 local S         = require("syscall")
@@ -43,6 +45,7 @@ frees     = counter.create("engine/frees.counter")     -- Total packets freed
 freebits  = counter.create("engine/freebits.counter")  -- Total packet bits freed (for 10GbE)
 freebytes = counter.create("engine/freebytes.counter") -- Total packet bytes freed
 configs   = counter.create("engine/configs.counter")   -- Total configurations loaded
+remote_packets = counter.create("engine/remote_packets.counter") -- Packets of remote NUMA nodes reused
 
 -- Breathing regluation to reduce CPU usage when idle by calling usleep(3).
 --
@@ -68,6 +71,70 @@ maxsleep = 100
 -- loop (100% CPU) instead of sleeping according to the Hz setting.
 busywait = false
 
+-- eventwait: If true then the engine, once it has been idle for
+-- eventwait_spin microseconds, blocks in epoll(7) until one of the
+-- wakeup file descriptors of its apps (see app:wakeup_fds()) becomes
+-- readable, or for at most eventwait_timeout milliseconds so that
+-- timers and apps without wakeup file descriptors still run. This
+-- replaces the sleeping according to the Hz setting.
+eventwait = false
+eventwait_spin = 50
+eventwait_timeout = 1
+
+-- push_on_demand: If true then the engine only calls push() on apps
+-- that have packets waiting on at least one of their input links, or
+-- that set the push_always field (e.g. to drive timers). Apps are
+-- still called in the order computed by compute_breathe_order().
+push_on_demand = false
+
+-- app_accounting: If set to a number N then the engine samples every
+-- Nth breath and records for each app the TSC cycles spent in its
+-- pull() and push() methods, the number of calls, and the packets it
+-- received from its input links and transmitted onto its output links.
+-- The samples accumulate in shm counters under engine/apps/<appname>/
+-- where they can be inspected with "snabb top".
+app_accounting = false
+
+-- fuse_chains: If true then the engine runs linear chains of fusable
+-- apps (push-only apps with exactly one input and one output link that
+-- set app.fusable, each feeding the next) back to back on batches of at
+-- most fuse_batch packets from the input link of the chain, so that
+-- packets stay in the CPU cache while they traverse the chain. Links
+-- inside a chain that have the default ring size are shrunk to
+-- fuse_link_size slots while the chain is fused.
+-- Statistics per chain accumulate in shm counters under
+-- engine/chains/<first app>..<last app>/. Takes effect on the next
+-- configure().
+fuse_chains = false
+fuse_batch = 32
+fuse_link_size = 64
+
+local chain_spec = {
+   batches = {counter},
+   packets = {counter},
+   cycles  = {counter}
+}
+
+-- link_dwell_timing: If true then the engine records for each link
+-- how many TSC cycles packets spend between being transmitted and
+-- received, in a histogram under links/<linkspec>/dwell.histogram
+-- (shown by "snabb top"). Can be switched on and off at runtime; it
+-- takes effect at the next breath.
+link_dwell_timing = false
+local dwell_timing = false
+
+-- Interval in seconds at which the engine polls for capture requests
+-- (see lib.capture).
+capture_poll_interval = 0.1
+local next_capture_poll = 0
+
+local app_accounting_spec = {
+   cycles    = {counter},
+   calls     = {counter},
+   rxpackets = {counter},
+   txpackets = {counter}
+}
+
 -- True when the engine is running the breathe loop.
 local running = false
 
@@ -81,11 +148,11 @@ end
 
 -- Run app:methodname() in protected mode (pcall). If it throws an
 -- error app will be marked as dead and restarted eventually.
-function with_restart (app, method)
+function with_restart (app, method, ...)
    local status, result
    if use_restart then
       -- Run fn in protected mode using pcall.
-      status, result = pcall(method, app)
+      status, result = pcall(method, app, ...)
 
       -- If pcall caught an error mark app as "dead" (record time and cause
       -- of death).
@@ -93,8 +160,37 @@ function with_restart (app, method)
          app.dead = { error = result, time = now() }
       end
    else
-      status, result = true, method(app)
+      status, result = true, method(app, ...)
+   end
+   return status, result
+end
+
+-- Return the total packets received on app's input links and the total
+-- packets transmitted on its output links.
+local function link_packets (app)
+   local input, output = app.input, app.output
+   local rx, tx = 0ULL, 0ULL
+   for i = 1, #input do rx = rx + counter.read(input[i].stats.rxpackets) end
+   for i = 1, #output do tx = tx + counter.read(output[i].stats.txpackets) end
+   return rx, tx
+end
+
+-- Like with_restart, and also record app accounting samples.
+function with_accounting (app, method, ...)
+   local acct = app.accounting
+   if not acct then
+      acct = shm.create_frame("engine/apps/"..app.appname, app_accounting_spec)
+      app.accounting = acct
    end
+   local rx, tx = link_packets(app)
+   local start = rdtsc()
+   local status, result = with_restart(app, method, ...)
+   local cycles = rdtsc() - start
+   local rx_after, tx_after = link_packets(app)
+   counter.add(acct.cycles, cycles)
+   counter.add(acct.calls)
+   counter.add(acct.rxpackets, rx_after - rx)
+   counter.add(acct.txpackets, tx_after - tx)
    return status, result
 end
 
@@ -223,8 +319,9 @@ function compute_config_actions (old, new)
    local actions = {}
 
    -- First determine the links that are going away and remove them.
-   for linkspec in pairs(old.links) do
-      if not new.links[linkspec] then
+   -- Links whose ring size changed are replaced.
+   for linkspec, size in pairs(old.links) do
+      if new.links[linkspec] ~= size then
          local fa, fl, ta, tl = config.parse_link(linkspec)
          table.insert(actions, {'unlink_output', {fa, fl}})
          table.insert(actions, {'unlink_input', {ta, tl}})
@@ -266,10 +363,12 @@ function compute_config_actions (old, new)
    end
 
    -- Now rebuild links.
-   for linkspec,_ in pairs(new.links) do
+   for linkspec, size in pairs(new.links) do
       local fa, fl, ta, tl = config.parse_link(linkspec)
-      local fresh_link = not old.links[linkspec]
-      if fresh_link then table.insert(actions, {'new_link', {linkspec}}) end
+      local fresh_link = old.links[linkspec] ~= size
+      if fresh_link then
+         table.insert(actions, {'new_link', {linkspec, size}})
+      end
       if not new.apps[fa] then error("no such app: " .. fa) end
       if not new.apps[ta] then error("no such app: " .. ta) end
       if fresh_link or fresh_apps[fa] then
@@ -319,9 +418,12 @@ function apply_config_actions (actions)
       link_table[linkspec] = nil
       configuration.links[linkspec] = nil
    end
-   function ops.new_link (linkspec)
-      link_table[linkspec] = link.new(linkspec)
-      configuration.links[linkspec] = true
+   function ops.new_link (linkspec, size)
+      link_table[linkspec] = link.new(linkspec, size)
+      if dwell_timing then
+         link.enable_dwell_timing(link_table[linkspec], linkspec)
+      end
+      configuration.links[linkspec] = size
    end
    function ops.link_output (appname, linkname, linkspec)
       local app = app_table[appname]
@@ -341,6 +443,7 @@ function apply_config_actions (actions)
       local app = app_table[name]
       if app.stop then app:stop() end
       if app.shm then shm.delete_frame(app.shm) end
+      if app.accounting then shm.delete_frame(app.accounting) end
       app_table[name] = nil
       configuration.apps[name] = nil
    end
@@ -403,6 +506,13 @@ end
 
 breathe_pull_order = {}
 breathe_push_order = {}
+-- Like breathe_push_order, but with the apps of fused chains replaced
+-- by their chain (see fuse_chains.)
+local breathe_push_schedule = {}
+-- All links, whose fill levels are sampled once per breath.
+local breathe_links = {}
+-- Apps that implement wakeup_fds (see wait_for_events.)
+local wakeup_apps = {}
 
 -- Sort the links in the app graph, and arrange to run push() on the
 -- apps on the receiving ends of those links.  This will run app:push()
@@ -462,6 +572,127 @@ function compute_breathe_order ()
          table.insert(breathe_push_order, inputs[link])
       end
    end
+   compute_push_schedule()
+   breathe_links = {}
+   for _, r in pairs(link_table) do table.insert(breathe_links, r) end
+   wakeup_apps = {}
+   for _, app in pairs(app_table) do
+      if app.wakeup_fds then table.insert(wakeup_apps, app) end
+   end
+end
+
+-- Fused chains by name.
+chains = {}
+
+-- Links shrunk to fuse_link_size because they are inside a chain.
+local fused_links = {}
+
+-- Replace the link linkspec with a new link of the given size (nil for
+-- the default size), moving over any packets on it.
+local function resize_link (linkspec, size)
+   local fa, fl, ta, tl = config.parse_link(linkspec)
+   local old = link_table[linkspec]
+   local packets = {}
+   while not link.empty(old) do table.insert(packets, link.receive(old)) end
+   link.free(old, linkspec)
+   local new = link.new(linkspec, size)
+   assert(#packets <= link.capacity(new), "packets do not fit resized link")
+   for _, p in ipairs(packets) do link.transmit(new, p) end
+   if dwell_timing then link.enable_dwell_timing(new, linkspec) end
+   link_table[linkspec] = new
+   for _, port in ipairs({{app_table[fa].output, fl},
+                          {app_table[ta].input, tl}}) do
+      local ports, name = unpack(port)
+      ports[name] = new
+      for i = 1, #ports do
+         if ports[i] == old then ports[i] = new end
+      end
+   end
+   for _, appname in ipairs({fa, ta}) do
+      local app = app_table[appname]
+      if app.link then app:link() end
+      if fa == ta then break end
+   end
+end
+
+-- Find linear chains of apps in breathe_push_order and compute
+-- breathe_push_schedule.
+function compute_push_schedule ()
+   local old_chains = chains
+   chains = {}
+   breathe_push_schedule = breathe_push_order
+   local internal = {} -- Linkspecs of the links inside chains.
+   if fuse_chains then
+      assert(fuse_batch < fuse_link_size, "fuse_batch must fit fused links")
+      local function fusable (app)
+         return app.fusable and app.push and not app.pull
+            and #app.input == 1 and #app.output == 1
+      end
+      local receiver, transmitter, linkspecs = {}, {}, {}
+      for appname, app in pairs(app_table) do
+         for _, l in ipairs(app.input) do receiver[l] = app end
+         for _, l in ipairs(app.output) do transmitter[l] = app end
+      end
+      for linkspec, l in pairs(link_table) do linkspecs[l] = linkspec end
+      -- A chain starts with a fusable app that is not fed by a fusable
+      -- app (which excludes cycles.)
+      local member = {}
+      for _, app in ipairs(breathe_push_order) do
+         local prev = transmitter[app.input[1]]
+         if fusable(app) and not (prev and fusable(prev)) then
+            local apps = {app}
+            local next = receiver[app.output[1]]
+            while next and fusable(next) do
+               table.insert(apps, next)
+               next = receiver[next.output[1]]
+            end
+            if #apps > 1 then
+               local name = apps[1].appname..".."..apps[#apps].appname
+               local chain = {name=name, fused_apps=apps, input=app.input[1]}
+               chain.stats = old_chains[name] and old_chains[name].stats
+                  or shm.create_frame("engine/chains/"..name, chain_spec)
+               old_chains[name] = nil
+               chains[name] = chain
+               for _, a in ipairs(apps) do member[a] = chain end
+               for i = 1, #apps - 1 do
+                  internal[linkspecs[apps[i].output[1]]] = true
+               end
+            end
+         end
+      end
+      -- Run each chain in place of its first app in breathe_push_order.
+      breathe_push_schedule = {}
+      local scheduled = {}
+      for _, app in ipairs(breathe_push_order) do
+         local chain = member[app]
+         if not chain then
+            table.insert(breathe_push_schedule, app)
+         elseif not scheduled[chain] then
+            table.insert(breathe_push_schedule, chain)
+            scheduled[chain] = true
+         end
+      end
+   end
+   for _, chain in pairs(old_chains) do shm.delete_frame(chain.stats) end
+   -- Links that are no longer inside a chain get their configured size
+   -- back, and default size links inside chains are shrunk.
+   for linkspec in pairs(fused_links) do
+      local l = link_table[linkspec]
+      if not internal[linkspec] then
+         if l and link.capacity(l) == fuse_link_size - 1 then
+            resize_link(linkspec, configuration.links[linkspec])
+         end
+         fused_links[linkspec] = nil
+      end
+   end
+   for linkspec in pairs(internal) do
+      local l = link_table[linkspec]
+      if not fused_links[linkspec] and link.capacity(l) == link.max
+         and link.nreadable(l) < fuse_link_size then
+         resize_link(linkspec, fuse_link_size)
+         fused_links[linkspec] = true
+      end
+   end
 end
 
 -- Call this to "run snabb switch".
@@ -484,7 +715,9 @@ function main (options)
    repeat
       breathe()
       if not no_timers then timer.run() end
-      if not busywait then pace_breathing() end
+      if not busywait then
+         if eventwait then wait_for_events() else pace_breathing() end
+      end
    until done and done()
    counter.commit()
    if not options.no_report then report(options.report) end
@@ -517,26 +750,142 @@ function pace_breathing ()
    end
 end
 
+local epoll, epoll_events
+local epoll_fds = {} -- file descriptor -> epoll_round it was last wanted
+local epoll_nfds = 0 -- number of file descriptors registered with epoll
+local epoll_round = 0
+local idle_since = false
+local function fdnum (fd)
+   return type(fd) == 'number' and fd or fd:getfd()
+end
+-- Block until an app has input once the engine is idle (see eventwait).
+function wait_for_events ()
+   local nfrees = tonumber(counter.read(frees))
+   if nfrees ~= lastfrees then
+      lastfrees = nfrees
+      idle_since = false
+      return
+   end
+   idle_since = idle_since or monotonic_now
+   if monotonic_now - idle_since < eventwait_spin / 1e6 then return end
+   if not epoll then
+      epoll = assert(S.epoll_create("cloexec"))
+      epoll_events = S.t.epoll_events(16)
+   end
+   -- Calling wakeup_fds also arms the apps' wakeups, so it happens
+   -- each time. Apps may add or remove file descriptors (e.g. when a
+   -- peer connects), but epoll is only updated when the set changes.
+   epoll_round = epoll_round + 1
+   local nwanted = 0
+   for i = 1, #wakeup_apps do
+      local app = wakeup_apps[i]
+      if not app.dead then
+         for _, fd in ipairs(app:wakeup_fds()) do
+            fd = fdnum(fd)
+            if not epoll_fds[fd] then
+               assert(S.epoll_ctl(epoll, "add", fd, "in"))
+               epoll_nfds = epoll_nfds + 1
+            end
+            if epoll_fds[fd] ~= epoll_round then nwanted = nwanted + 1 end
+            epoll_fds[fd] = epoll_round
+         end
+      end
+   end
+   if nwanted < epoll_nfds then
+      for fd, round in pairs(epoll_fds) do
+         if round ~= epoll_round then
+            S.epoll_ctl(epoll, "del", fd)
+            epoll_fds[fd] = nil
+            epoll_nfds = epoll_nfds - 1
+         end
+      end
+   end
+   S.epoll_wait(epoll, epoll_events, eventwait_timeout)
+end
+
+-- Return true if any of app's input links has packets waiting.
+function has_input (app)
+   local input = app.input
+   for i = 1, #input do
+      if not link.empty(input[i]) then return true end
+   end
+   return false
+end
+
+-- Run the apps of a fused chain on batches of at most fuse_batch
+-- packets from the input link of the chain until it is empty. Each app
+-- is called at least once per breath, like unfused apps. The batch is
+-- imposed by calling the first app with push(fuse_batch), which takes
+-- at most that many packets from the input of the chain (see
+-- app.fusable.) The other apps are called with no limit and drain
+-- their input, so the links inside the chain are empty after each
+-- batch.
+local function run_chain (chain, run)
+   local apps, input = chain.fused_apps, chain.input
+   local start = rdtsc()
+   local batches, packets = 0, 0
+   repeat
+      local before = link.nreadable(input)
+      for i = 1, #apps do
+         local app = apps[i]
+         if not app.dead
+            and (not push_on_demand or app.push_always or has_input(app)) then
+            zone(app.zone)
+            run(app, app.push, i == 1 and fuse_batch or nil)
+            zone()
+         end
+      end
+      local n = before - link.nreadable(input)
+      batches, packets = batches + 1, packets + n
+   until n == 0 or link.empty(input)
+   local stats = chain.stats
+   counter.add(stats.batches, batches)
+   counter.add(stats.packets, packets)
+   counter.add(stats.cycles, rdtsc() - start)
+end
+
+-- Switch dwell-time measurement on all links to link_dwell_timing.
+local function apply_dwell_timing ()
+   dwell_timing = link_dwell_timing
+   for linkspec, r in pairs(link_table) do
+      if dwell_timing then link.enable_dwell_timing(r, linkspec)
+      else                 link.disable_dwell_timing(r, linkspec) end
+   end
+end
+
 function breathe ()
    running = true
    monotonic_now = C.get_monotonic_time()
+   if link_dwell_timing ~= dwell_timing then apply_dwell_timing() end
    -- Restart: restart dead apps
    restart_dead_apps()
+   -- Sample app accounting this breath?
+   local run = with_restart
+   if app_accounting and counter.read(breaths) % app_accounting == 0 then
+      run = with_accounting
+   end
    -- Inhale: pull work into the app network
    for i = 1, #breathe_pull_order do
       local app = breathe_pull_order[i]
       if app.pull and not app.dead then
          zone(app.zone)
-         with_restart(app, app.pull)
+         run(app, app.pull)
          zone()
       end
    end
+   -- Sample link fill levels while the inputs are at their fullest
+   for i = 1, #breathe_links do
+      link.update_highwater(breathe_links[i])
+   end
    -- Exhale: push work out through the app network
-   for i = 1, #breathe_push_order do
-      local app = breathe_push_order[i]
-      if app.push and not app.dead then
+   for i = 1, #breathe_push_schedule do
+      local app = breathe_push_schedule[i]
+      if app.fused_apps then
+         run_chain(app, run)
+      elseif app.push and not app.dead
+         and (not push_on_demand or app.push_always or has_input(app)) then
          zone(app.zone)
-         with_restart(app, app.push)
+         run(app, app.push)
          zone()
       end
    end
@@ -545,6 +894,10 @@ function breathe ()
    if counter.read(breaths) % 100 == 0 then
       counter.commit()
       packet.rebalance_freelists()
+      if monotonic_now >= next_capture_poll then
+         capture.poll(link_table)
+         next_capture_poll = monotonic_now + capture_poll_interval
+      end
    end
    running = false
 end
@@ -559,6 +912,9 @@ function report (options)
    if options and options.showapps then
       report_apps()
    end
+   if options and options.showchains then
+      report_chains()
+   end
 end
 
 -- Load reporting prints several metrics:
@@ -620,6 +976,23 @@ function report_links ()
    end
 end
 
+function report_chains ()
+   print("fused chains report:")
+   local names = {}
+   for name in pairs(chains) do table.insert(names, name) end
+   table.sort(names)
+   for _, name in ipairs(names) do
+      local stats = chains[name].stats
+      local batches = tonumber(counter.read(stats.batches))
+      local packets = tonumber(counter.read(stats.packets))
+      local cycles = tonumber(counter.read(stats.cycles))
+      print(("%20s packets in %s batches (%.1f/batch, %.1f cycles/packet) on %s"):format(
+            lib.comma_value(packets), lib.comma_value(batches),
+            batches > 0 and packets / batches or 0,
+            packets > 0 and cycles / packets or 0, name))
+   end
+end
+
 function report_apps ()
    print ("apps report:")
    for name, app in pairs(app_table) do
@@ -681,6 +1054,18 @@ function selftest ()
    assert(app_table.app2 == orig_app2) -- should be the same
    assert(#breathe_pull_order == 0)
    assert(#breathe_push_order == 1)
+   print("c1 -> c1 (link size 256)")
+   local c1_small = config.new()
+   config.app(c1_small, "app1", App)
+   config.app(c1_small, "app2", App)
+   config.link(c1_small, "app1.x -> app2.x", 256)
+   configure(c1_small)
+   assert(app_table.app2 == orig_app2)
+   assert(link.capacity(link_table['app1.x -> app2.x']) == 255)
+   assert(app_table.app1.output.x == link_table['app1.x -> app2.x'])
+   assert(app_table.app2.input.x == link_table['app1.x -> app2.x'])
+   configure(c1)
+   assert(link.capacity(link_table['app1.x -> app2.x']) == link.max)
    print("c1 -> empty")
    configure(config.new())
    assert(#breathe_pull_order == 0)
@@ -735,6 +1120,166 @@ function selftest ()
    engine.stop()
    assert(lib.equal(app_table, {}))
 
+   -- Test demand-driven push scheduling.
+   print("push_on_demand")
+   use_restart = false
+   local Counter = {}
+   function Counter:new () return setmetatable({pushes=0}, {__index=Counter}) end
+   function Counter:push ()
+      self.pushes = self.pushes + 1
+      for _, i in ipairs(self.input) do
+         while not link.empty(i) do packet.free(link.receive(i)) end
+      end
+   end
+   local Ticker = setmetatable({push_always=true}, {__index=Counter})
+   function Ticker:new () return setmetatable({pushes=0}, {__index=Ticker}) end
+   local c_demand = config.new()
+   config.app(c_demand, "idle", Counter)
+   config.app(c_demand, "ticker", Ticker)
+   config.app(c_demand, "busy", Counter)
+   config.link(c_demand, "idle.output -> ticker.input")
+   config.link(c_demand, "ticker.output -> busy.input")
+   configure(c_demand)
+   push_on_demand = true
+   for _ = 1, 10 do breathe() end
+   assert(app_table.ticker.pushes == 10)
+   assert(app_table.busy.pushes == 0)
+   link.transmit(app_table.ticker.output.output, packet.allocate())
+   breathe()
+   assert(app_table.busy.pushes == 1)
+   breathe()
+   assert(app_table.busy.pushes == 1)
+   push_on_demand = false
+   breathe()
+   assert(app_table.busy.pushes == 2)
+
+   -- Test app accounting.
+   print("app_accounting")
+   app_accounting = 1
+   link.transmit(app_table.ticker.output.output, packet.allocate())
+   link.transmit(app_table.ticker.output.output, packet.allocate())
+   breathe()
+   local acct = app_table.busy.accounting
+   assert(counter.read(acct.calls) == 1)
+   assert(counter.read(acct.rxpackets) == 2)
+   assert(counter.read(acct.txpackets) == 0)
+   assert(counter.read(acct.cycles) > 0)
+   assert(shm.exists("engine/apps/busy/cycles.counter"))
+   app_accounting = false
+   breathe()
+   assert(counter.read(acct.calls) == 1)
+
+   -- Test link dwell-time measurement.
+   print("link_dwell_timing")
+   local dwell = "links/ticker.output -> busy.input/dwell.histogram"
+   assert(not shm.exists(dwell))
+   link_dwell_timing = true
+   breathe()
+   assert(shm.exists(dwell))
+   link.transmit(app_table.ticker.output.output, packet.allocate())
+   breathe()
+   local h = histogram.open(dwell)
+   assert(h.total == 1)
+   shm.unmap(h)
+   link_dwell_timing = false
+   breathe()
+   assert(not shm.exists(dwell))
+   engine.stop()
+   assert(not shm.exists("engine/apps/busy/cycles.counter"))
+
+   -- Test blocking on wakeup file descriptors.
+   print("eventwait")
+   local Waiter = {}
+   function Waiter:new ()
+      local _, _, r, w = assert(S.pipe())
+      return setmetatable({r=r, w=w, waits=0}, {__index=Waiter})
+   end
+   function Waiter:wakeup_fds ()
+      self.waits = self.waits + 1
+      return {self.r}
+   end
+   function Waiter:stop () self.r:close() self.w:close() end
+   local c_wait = config.new()
+   config.app(c_wait, "waiter", Waiter)
+   configure(c_wait)
+   eventwait, eventwait_spin, eventwait_timeout = true, 0, 20
+   main({duration=0.2, no_report=true})
+   -- Blocked until the timeout in each idle breath.
+   assert(app_table.waiter.waits <= 11)
+   -- A readable file descriptor ends the wait right away.
+   app_table.waiter.w:write("x")
+   main({duration=0.1, no_report=true})
+   assert(app_table.waiter.waits > 100)
+   eventwait = false
+   engine.stop()
+
+   -- Test fused chains.
+   print("fuse_chains")
+   local Forward = {fusable=true}
+   function Forward:new () return setmetatable({pushes=0}, {__index=Forward}) end
+   function Forward:push (limit)
+      self.pushes, self.limit = self.pushes + 1, limit
+      local i, o = self.input[1], self.output[1]
+      for _ = 1, math.min(link.nreadable(i), limit or math.huge) do
+         link.transmit(o, link.receive(i))
+      end
+   end
+   local c_fuse = config.new()
+   config.app(c_fuse, "source", Counter)
+   config.app(c_fuse, "a", Forward)
+   config.app(c_fuse, "b", Forward)
+   config.app(c_fuse, "c", Forward)
+   config.app(c_fuse, "sink", Counter)
+   config.link(c_fuse, "source.output -> a.input")
+   config.link(c_fuse, "a.output -> b.input")
+   config.link(c_fuse, "b.output -> c.input")
+   config.link(c_fuse, "c.output -> sink.input")
+   fuse_chains = true
+   configure(c_fuse)
+   local chain = assert(chains["a..c"])
+   assert(#chain.fused_apps == 3 and chain.input == app_table.a.input.input)
+   assert(shm.exists("engine/chains/a..c/packets.counter"))
+   local ab = link_table["a.output -> b.input"]
+   assert(link.capacity(ab) == fuse_link_size - 1)
+   assert(app_table.a.output.output == ab and app_table.b.input[1] == ab)
+   assert(link.capacity(link_table["c.output -> sink.input"]) == link.max)
+   local head = app_table.source.output.output
+   for i = 1, 1000 do link.transmit(head, packet.allocate()) end
+   breathe()
+   assert(link.empty(head))
+   assert(counter.read(link_table["c.output -> sink.input"].stats.txpackets)
+             == 1000)
+   assert(counter.read(ab.stats.txdrop) == 0)
+   assert(counter.read(chain.stats.packets) == 1000)
+   assert(counter.read(chain.stats.batches) == math.ceil(1000 / fuse_batch))
+   assert(app_table.a.pushes == counter.read(chain.stats.batches))
+   assert(link.empty(ab) and app_table.a.limit == fuse_batch)
+   assert(app_table.b.limit == nil and app_table.c.limit == nil)
+   breathe()
+   assert(app_table.c.pushes == counter.read(chain.stats.batches))
+   report_chains()
+   configure(c_fuse)
+   assert(chains["a..c"] and chains["a..c"].stats == chain.stats)
+   assert(link_table["a.output -> b.input"] == ab)
+   -- Unfusing restores the configured link size, keeping packets.
+   for i = 1, 10 do link.transmit(ab, packet.allocate()) end
+   fuse_chains = false
+   configure(c_fuse)
+   assert(not next(chains))
+   assert(not shm.exists("engine/chains/a..c/packets.counter"))
+   ab = link_table["a.output -> b.input"]
+   assert(link.capacity(ab) == link.max and link.nreadable(ab) == 10)
+   assert(app_table.a.output.output == ab and app_table.b.input[1] == ab)
+   -- Apps that do not set the fusable field are never fused.
+   fuse_chains = true
+   Forward.fusable = false
+   configure(config.new())
+   configure(c_fuse)
+   assert(not next(chains))
+   Forward.fusable = true
+   fuse_chains = false
+   engine.stop()
+
    -- Check one can't unclaim a name if no name is claimed.
    assert(not pcall(unclaim_name))
    
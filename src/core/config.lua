@@ -5,13 +5,17 @@
 module(..., package.seeall)
 
 local lib = require("core.lib")
+local ffi = require("ffi")
+local C = ffi.C
+require("core.link_h")
 
 -- API: Create a new configuration.
 -- Initially there are no apps or links.
 function new ()
    return {
       apps = {},         -- list of {name, class, args}
-      links = {}         -- table with keys like "a.out -> b.in"
+      links = {}         -- table with keys like "a.out -> b.in" and
+                         -- ring sizes as values
    }
 end
 
@@ -37,9 +41,21 @@ end
 
 -- API: Add a link to the configuration.
 --
+-- config.link(c, spec, size):
+--   c is a config object.
+--   spec is a link specification (see parse_link).
+--   size is the number of slots in the link's ring buffer (optional).
+--     It must be a power of two. The default is C.LINK_RING_SIZE.
+--
 -- Example: config.link(c, "nic.tx -> vm.rx")
-function link (config, spec)
-   config.links[canonical_link(spec)] = true
+--          config.link(c, "nic.tx -> vm.rx", 4096)
+function link (config, spec, size)
+   size = size or C.LINK_RING_SIZE
+   assert(size >= C.LINK_MIN_RING_SIZE and size <= C.LINK_MAX_RING_SIZE
+             and bit.band(size, size - 1) == 0,
+          "link size must be a power of two between "..C.LINK_MIN_RING_SIZE
+             .." and "..C.LINK_MAX_RING_SIZE..": "..tostring(size))
+   config.links[canonical_link(spec)] = size
 end
 
 -- Given "a.out -> b.in" return "a", "out", "b", "in".
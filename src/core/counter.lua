@@ -14,12 +14,25 @@
 -- use counters to keep track of why this is actually happening.
 --
 -- You can access the counters using this module, or the raw core.shm
--- module, or even directly on disk. Each counter is an 8-byte ramdisk
--- file that contains the 64-bit value in native host endian.
+-- module, or even directly on disk. The values of all counters created
+-- by a process are packed densely into "counter arena" files under
+-- counters/ in its shm tree, and each counter is a 16-byte ramdisk file
+-- that indexes the arena: a format marker ("SNC1"), the pid of the
+-- creating process, the slot of the counter and the generation of the
+-- slot (all 32-bit, native host endian.) Slot n is at offset
+-- 8*(n % 4096) of counters/<floor(n/4096)>.arena and holds the 64-bit
+-- value in native host endian; the 32-bit generation of slot n follows
+-- the 4096 values at offset 32768+4*(n % 4096).
+--
+-- Counter files in the previous format hold the 64-bit value itself
+-- (8 bytes, no marker.) open() still reads those, and older readers fail
+-- on the size of an index instead of misreading it as a value.
 --
 -- For example, you can read a counter on the command line with od(1):
 -- 
---     # od -A none -t u8 /var/run/snabb/15347/counter/a
+--     # od -A none -t u4 /var/run/snabb/15347/counter/a
+--     826494547 15347 3 0
+--     # od -A none -t u8 -j 24 -N 8 /var/run/snabb/15347/counters/0.arena
 --     43
 
 
@@ -28,62 +41,164 @@ module(..., package.seeall)
 local lib = require("core.lib")
 local shm = require("core.shm")
 local ffi = require("ffi")
+local S = require("syscall")
 require("core.counter_h")
 
 type = shm.register('counter', getfenv())
 
 local counter_t = ffi.typeof("struct counter")
+local counter_ptr_t = ffi.typeof("struct counter *")
+local index_t = ffi.typeof[[
+   struct { uint32_t magic, pid, slot, generation; }
+]]
+local index_magic = 0x31434e53 -- "SNC1"
+
+local arena_size = 4096 -- Counters per arena file
+local arena_t = ffi.typeof("struct counter[$]", arena_size)
+local arena_file_t = ffi.typeof([[
+   struct { struct counter value[$]; uint32_t generation[$]; }
+]], arena_size, arena_size)
+
+-- Slots of deleted counters are reused only after this many other
+-- counters have been deleted, so that readers that still map a deleted
+-- counter keep seeing its last value for a while. The generation of a
+-- slot is bumped on deletion, and open() uses it to detect reuse.
+local tombstones = 1024
+
+local function arena_name (pid, n)
+   return "/"..pid.."/counters/"..n..".arena"
+end
 
 -- Double buffering:
 -- For each counter we have a private copy to update directly and then
 -- a public copy in shared memory that we periodically commit to.
 --
--- This is important for a subtle performance reason: the shared
--- memory counters all have page-aligned addresses (thanks to mmap)
--- and accessing many of them can lead to expensive cache misses (due
--- to set-associative CPU cache). See snabbco/snabb#558.
-local public  = {}
-local private = {}
-local numbers = {} -- name -> number
+-- This is important for a subtle performance reason: accessing many
+-- counters in shared memory can lead to expensive cache misses and TLB
+-- pressure. See snabbco/snabb#558. Packing them into arenas means
+-- there are few mappings, and commit() copies each arena in bulk.
+local arenas = {}    -- Arenas of this process: {public, private}
+local nslots = 0     -- Slots used in arenas (high-water mark)
+local free = {}      -- FIFO of slots of deleted counters for reuse
+local free_head, free_tail = 1, 1
+local counters = {}  -- name -> {counter, slot} or {counter, mapping}
+local mappings = {}  -- Arenas of other processes by name: {arena, refs}
+
+local function allocate_slot ()
+   if free_tail - free_head > tombstones then
+      local slot = free[free_head]
+      free[free_head], free_head = nil, free_head + 1
+      return slot
+   end
+   local slot
+   slot, nslots = nslots, nslots + 1
+   local n = math.floor(slot / arena_size)
+   if not arenas[n+1] then
+      arenas[n+1] = {public=shm.create(arena_name(S.getpid(), n), arena_file_t),
+                     private=ffi.new(arena_t)}
+   end
+   return slot
+end
+
+local function slot_counter (arena, slot)
+   return ffi.cast(counter_ptr_t, arena) + slot % arena_size
+end
 
 function create (name, initval)
-   if numbers[name] then return private[numbers[name]] end
-   local n = #public+1
-   public[n] = shm.create(name, counter_t)
-   private[n] = ffi.new(counter_t)
-   numbers[name] = n
-   if initval then set(private[n], initval) end
-   return private[n]
+   if counters[name] then return counters[name].counter end
+   local slot = allocate_slot()
+   local arena = arenas[math.floor(slot / arena_size) + 1]
+   local counter = slot_counter(arena.private, slot)
+   set(counter, initval or 0)
+   arena.public.value[slot % arena_size].c = counter.c
+   -- Write the index under a temporary name and rename it so that other
+   -- processes never see it incomplete.
+   local tmp = name..".tmp"
+   local index = shm.create(tmp, index_t)
+   index.magic, index.pid, index.slot = index_magic, S.getpid(), slot
+   index.generation = arena.public.generation[slot % arena_size]
+   shm.unmap(index)
+   assert(S.rename(shm.root.."/"..shm.resolve(tmp),
+                   shm.root.."/"..shm.resolve(name)))
+   counters[name] = {counter=counter, slot=slot}
+   return counter
+end
+
+-- Map the public copy of the counter by name (which may have been
+-- created by another process.)
+local function map (name)
+   local stat = S.stat(shm.root.."/"..shm.resolve(name))
+   if stat and stat.size == ffi.sizeof(counter_t) then
+      -- Counter file in the previous format: the value itself.
+      return {counter=shm.open(name, counter_t, 'readonly')}
+   end
+   local index = shm.open(name, index_t, 'readonly')
+   local magic, pid, slot = index.magic, index.pid, index.slot
+   local generation = index.generation
+   shm.unmap(index)
+   if magic ~= index_magic then
+      error(("counter: unknown format marker 0x%08x: %s"):format(magic, name))
+   end
+   local arena = arena_name(pid, math.floor(slot / arena_size))
+   local mapping = mappings[arena]
+   if not mapping then
+      mapping = {arena=shm.open(arena, arena_file_t, 'readonly'), refs=0}
+      mappings[arena] = mapping
+   end
+   mapping.refs = mapping.refs + 1
+   return {counter=slot_counter(mapping.arena.value, slot),
+           mapping=mapping, arena=arena, slot=slot, generation=generation}
+end
+
+local function unmap (entry)
+   if not entry.mapping then shm.unmap(entry.counter) return end
+   entry.mapping.refs = entry.mapping.refs - 1
+   if entry.mapping.refs == 0 then
+      shm.unmap(entry.mapping.arena)
+      mappings[entry.arena] = nil
+   end
+end
+
+-- Has the slot of a mapped counter been released by its owner?
+local function stale (entry)
+   return entry.mapping and entry.mapping.arena.generation[
+      entry.slot % arena_size] ~= entry.generation
 end
 
 function open (name)
-   if numbers[name] then return private[numbers[name]] end
-   local n = #public+1
-   public[n] = shm.open(name, counter_t, 'readonly')
-   private[n] = public[#public] -- use counter directly
-   numbers[name] = n
-   return private[n]
+   local entry = counters[name]
+   if entry and not stale(entry) then return entry.counter end
+   if entry then unmap(entry) end
+   counters[name] = map(name) -- use counter directly
+   return counters[name].counter
 end
 
 function delete (name)
-   local number = numbers[name]
-   if not number then error("counter not found for deletion: " .. name) end
-   -- Free shm object
-   shm.unmap(public[number])
-   -- If we "own" the counter for writing then we unlink it too.
-   if public[number] ~= private[number] then
+   local entry = counters[name]
+   if not entry then error("counter not found for deletion: " .. name) end
+   if entry.mapping or not entry.slot then
+      -- Free mapping of opened counter.
+      unmap(entry)
+   else
+      -- We "own" the counter: unlink it and retire its slot. The public
+      -- value stays until the slot is reused.
+      local arena = arenas[math.floor(entry.slot / arena_size) + 1]
+      local public = arena.public
       shm.unlink(name)
+      public.generation[entry.slot % arena_size] =
+         public.generation[entry.slot % arena_size] + 1
+      free[free_tail], free_tail = entry.slot, free_tail + 1
    end
    -- Free local state
-   numbers[name] = false
-   public[number] = false
-   private[number] = false
+   counters[name] = nil
 end
 
 -- Copy counter private counter values to public shared memory.
 function commit ()
-   for i = 1, #public do
-      if public[i] ~= private[i] then public[i].c = private[i].c end
+   for n, arena in ipairs(arenas) do
+      local used = math.min(arena_size, nslots - (n-1) * arena_size)
+      ffi.copy(arena.public.value, arena.private,
+               used * ffi.sizeof(counter_t))
    end
 end
 
@@ -98,18 +213,92 @@ ffi.metatype( counter_t,
 function selftest ()
    print("selftest: core.counter")
    local a  = create("core.counter/counter/a")
-   local b  = create("core.counter/counter/b")
-   local a2 = shm.create("core.counter/counter/a", counter_t, true)
+   local b  = create("core.counter/counter/b", 7)
+   -- Public copies, as seen by other processes.
+   local a2 = map("core.counter/counter/a")
+   local b2 = map("core.counter/counter/b")
+   assert(b2.counter.c == 7)
    set(a, 42)
    set(b, 43)
    assert(read(a) == 42)
    assert(read(b) == 43)
    commit()
-   assert(read(a) == a2.c)
+   assert(read(a) == a2.counter.c)
+   assert(read(b) == b2.counter.c)
    add(a, 1)
    assert(read(a) == 43)
    commit()
-   assert(read(a) == a2.c)
+   assert(read(a) == a2.counter.c)
+   assert(a2.mapping == b2.mapping and a2.mapping.refs == 2)
+   unmap(b2)
+   assert(a2.mapping.refs == 1)
+   -- Deleted counters keep their last value until their slot is reused,
+   -- which the generation in the arena reveals.
+   local slot = counters["core.counter/counter/a"].slot
+   delete("core.counter/counter/a")
+   assert(not shm.exists("core.counter/counter/a"))
+   assert(stale(a2))
+   commit()
+   assert(a2.counter.c == 43)
+   local c = create("core.counter/counter/c")
+   assert(counters["core.counter/counter/c"].slot ~= slot)
+   for i = 1, tombstones do
+      create("core.counter/tombstone/"..i)
+      delete("core.counter/tombstone/"..i)
+   end
+   local d = create("core.counter/counter/d")
+   assert(counters["core.counter/counter/d"].slot == slot)
+   assert(read(d) == 0)
+   commit()
+   assert(a2.counter.c == 0)
+   local d2 = map("core.counter/counter/d")
+   assert(d2.counter == a2.counter and not stale(d2))
+   unmap(a2)
+   unmap(d2)
+   assert(not next(mappings))
+   -- Readers reopen counters that were deleted and created again.
+   local name = "core.counter/counter/e"
+   create(name, 8)
+   commit()
+   local owner, reader = counters[name], map(name)
+   counters[name] = owner
+   delete(name)
+   create(name, 9)
+   commit()
+   owner, counters[name] = counters[name], reader
+   assert(read(open(name)) == 9)
+   unmap(counters[name])
+   counters[name] = owner
+   delete(name)
+   -- Counter files in the previous format are read directly.
+   local old = shm.create("core.counter/counter/old", counter_t)
+   old.c = 5
+   shm.unmap(old)
+   assert(read(open("core.counter/counter/old")) == 5)
+   delete("core.counter/counter/old")
+   shm.unlink("core.counter/counter/old")
+   -- Index files with an unknown marker are rejected.
+   local bad = shm.create("core.counter/counter/bad", index_t)
+   shm.unmap(bad)
+   assert(not pcall(open, "core.counter/counter/bad"))
+   shm.unlink("core.counter/counter/bad")
+   -- Many counters span several arenas.
+   local many = {}
+   for i = 1, arena_size + 10 do
+      many[i] = create("core.counter/many/"..i)
+      set(many[i], i)
+   end
+   assert(#arenas >= 2)
+   commit()
+   for _, i in ipairs({1, arena_size, arena_size + 10}) do
+      local entry = map("core.counter/many/"..i)
+      assert(read(entry.counter) == i)
+      unmap(entry)
+   end
+   for i = 1, arena_size + 10 do delete("core.counter/many/"..i) end
+   delete("core.counter/counter/b")
+   delete("core.counter/counter/c")
+   delete("core.counter/counter/d")
    shm.unlink("core.counter")
    print("selftest ok")
 end
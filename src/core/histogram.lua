@@ -19,6 +19,7 @@ local histogram_t = ffi.typeof([[struct {
    uint64_t total;
    uint64_t buckets[509];
 }]])
+ptr_t = ffi.typeof("$*", histogram_t)
 
 local function compute_growth_factor_log(minimum, maximum)
    assert(minimum > 0)
@@ -1,19 +1,36 @@
 /* Use of this source code is governed by the Apache 2.0 license; see COPYING. */
 
-enum { LINK_RING_SIZE    = 1024,
-       LINK_MAX_PACKETS  = LINK_RING_SIZE - 1
+// Ring sizes must be powers of two. Each link has its own ring size
+// between LINK_MIN_RING_SIZE and LINK_MAX_RING_SIZE (default:
+// LINK_RING_SIZE). A ring of size N holds at most N-1 packets.
+enum { LINK_RING_SIZE     = 1024,
+       LINK_MAX_PACKETS   = LINK_RING_SIZE - 1,
+       LINK_MIN_RING_SIZE = 2,
+       LINK_MAX_RING_SIZE = 16384
 };
 
 struct link {
-  // this is a circular ring buffer, as described at:
-  //   http://en.wikipedia.org/wiki/Circular_buffer
-  struct packet *packets[LINK_RING_SIZE];
   struct {
-    struct counter *dtime, *txbytes, *rxbytes, *txpackets, *rxpackets, *txdrop;
+    struct counter *dtime, *txbytes, *rxbytes, *txpackets, *rxpackets, *txdrop,
+                   *capacity, *highwater;
   } stats;
   // Two cursors:
   //   read:  the next element to be read
   //   write: the next element to be written
   int read, write;
+  // Ring size minus one, used to wrap the cursors.
+  int mask;
+  // Dwell-time measurement (see link.enable_dwell_timing), NULL when off:
+  //   tsc:   parallel ring of TSC values taken when packets are transmitted
+  //   dwell: histogram of TSC cycles between transmit and receive
+  uint64_t *tsc;
+  void *dwell;
+  // Index of the capture tap armed on this link (see lib.capture), 0
+  // when none.
+  int tap;
+  // this is a circular ring buffer, as described at:
+  //   http://en.wikipedia.org/wiki/Circular_buffer
+  // The ring is allocated together with the link (variable-length
+  // struct, see link.new).
+  struct packet *packets[?];
 };
-
@@ -14,28 +14,52 @@ require("core.packet_h")
 local counter = require("core.counter")
 require("core.counter_h")
 
+local histogram = require("core.histogram")
+local capture = require("lib.capture")
+local rdtsc = require("lib.tsc").rdtsc
+
 require("core.link_h")
 local link_t = ffi.typeof("struct link")
 
 local band = require("bit").band
+local min = math.min
+
+max           = C.LINK_MAX_PACKETS   -- Capacity of a default size link
+max_ring_size = C.LINK_MAX_RING_SIZE
 
-local size = C.LINK_RING_SIZE         -- NB: Huge slow-down if this is not local
-max        = C.LINK_MAX_PACKETS
+local batch_t = ffi.typeof("struct packet *[?]")
+local tsc_ring_t = ffi.typeof("uint64_t[?]")
 
 local provided_counters = {
-   "dtime", "rxpackets", "rxbytes", "txpackets", "txbytes", "txdrop"
+   "dtime", "rxpackets", "rxbytes", "txpackets", "txbytes", "txdrop",
+   "capacity", "highwater"
 }
 
-function new (name)
-   local r = ffi.new(link_t)
+-- Create a new link. Size is the number of slots in the ring, which
+-- must be a power of two (default: C.LINK_RING_SIZE).
+function new (name, size)
+   size = size or C.LINK_RING_SIZE
+   assert(valid_size(size), "invalid link size: "..tostring(size))
+   local r = ffi.new(link_t, size)
+   r.mask = size - 1
    for _, c in ipairs(provided_counters) do
       r.stats[c] = counter.create("links/"..name.."/"..c..".counter")
    end
    counter.set(r.stats.dtime, C.get_unix_time())
+   counter.set(r.stats.capacity, r.mask)
    return r
 end
 
+-- Return true if size is a valid link ring size.
+function valid_size (size)
+   return type(size) == 'number'
+      and size >= C.LINK_MIN_RING_SIZE and size <= C.LINK_MAX_RING_SIZE
+      and band(size, size - 1) == 0
+end
+
 function free (r, name)
+   disable_dwell_timing(r, name)
+   r.tap = 0
    while not empty(r) do
       packet.free(receive(r))
    end
@@ -45,33 +69,145 @@ function free (r, name)
    shm.unlink("links/"..name)
 end
 
+-- Dwell-time measurement: while enabled, each transmitted packet is
+-- stamped with the TSC in a ring parallel to r.packets, and the cycles
+-- it spent on the link are recorded when it is received. Off by default;
+-- then the only cost is a test of r.tsc in transmit and receive.
+
+-- Objects referenced by the C pointers of links with dwell timing on.
+local dwell_anchors = {}
+
+local function dwell_histogram_name (name)
+   return "links/"..name.."/dwell.histogram"
+end
+
+-- Start recording dwell times for r in the histogram
+-- links/<name>/dwell.histogram (in TSC cycles).
+function enable_dwell_timing (r, name)
+   if r.tsc ~= nil then return end
+   local tsc = ffi.new(tsc_ring_t, r.mask + 1)
+   local dwell = histogram.create(dwell_histogram_name(name), 1e1, 1e10)
+   -- Packets already on the link count as transmitted now.
+   local now = rdtsc()
+   for i = 0, r.mask do tsc[i] = now end
+   r.tsc, r.dwell = tsc, dwell
+   dwell_anchors[name] = {tsc, dwell}
+end
+
+-- Stop recording dwell times for r and remove its histogram.
+function disable_dwell_timing (r, name)
+   if r.tsc == nil then return end
+   local dwell = ffi.cast(histogram.ptr_t, r.dwell)
+   r.tsc, r.dwell = nil, nil
+   dwell_anchors[name] = nil
+   shm.unmap(dwell)
+   shm.unlink(dwell_histogram_name(name))
+end
+
+local function record_dwell (r, read, now)
+   ffi.cast(histogram.ptr_t, r.dwell):add(tonumber(now - r.tsc[read]))
+end
+
 function receive (r)
 --   if debug then assert(not empty(r), "receive on empty link") end
    local p = r.packets[r.read]
-   r.read = band(r.read + 1, size - 1)
+   if r.tsc ~= nil then record_dwell(r, r.read, rdtsc()) end
+   r.read = band(r.read + 1, r.mask)
 
    counter.add(r.stats.rxpackets)
    counter.add(r.stats.rxbytes, p.length)
    return p
 end
 
+-- Receive up to n packets from r into array (zero-based). Returns the
+-- number of packets received. Counters are updated once per batch.
+function receive_batch (r, array, n)
+   n = min(n, nreadable(r))
+   local read, mask, bytes = r.read, r.mask, 0 -- NB: keep mask local
+   if r.tsc ~= nil then
+      local now = rdtsc()
+      for i = 0, n - 1 do record_dwell(r, band(read + i, mask), now) end
+   end
+   for i = 0, n - 1 do
+      local p = r.packets[read]
+      array[i] = p
+      bytes = bytes + p.length
+      read = band(read + 1, mask)
+   end
+   r.read = read
+   counter.add(r.stats.rxpackets, n)
+   counter.add(r.stats.rxbytes, bytes)
+   return n
+end
+
 function front (r)
    return (r.read ~= r.write) and r.packets[r.read] or nil
 end
 
+-- Record the current ring fill level if it is a new high-water mark.
+-- This is sampled once per transmit_batch() and, by the engine, once
+-- per breath rather than on every transmit().
+function update_highwater (r)
+   local nfill = nreadable(r)
+   if nfill > counter.read(r.stats.highwater) then
+      counter.set(r.stats.highwater, nfill)
+   end
+end
+
 function transmit (r, p)
 --   assert(p)
    if full(r) then
       counter.add(r.stats.txdrop)
       packet.free(p)
    else
+      local mask = r.mask
+      local write = band(r.write + 1, mask)
       r.packets[r.write] = p
-      r.write = band(r.write + 1, size - 1)
+      if r.tsc ~= nil then r.tsc[r.write] = rdtsc() end
+      if r.tap ~= 0 then capture.tap(r, p) end
+      r.write = write
       counter.add(r.stats.txpackets)
       counter.add(r.stats.txbytes, p.length)
    end
 end
 
+-- Transmit n packets from array (zero-based) onto r. Packets that do
+-- not fit are dropped. Counters are updated once per batch.
+function transmit_batch (r, array, n)
+   local ntx = min(n, nwritable(r))
+   local write, mask, bytes = r.write, r.mask, 0 -- NB: keep mask local
+   if r.tsc ~= nil then
+      local now = rdtsc()
+      for i = 0, ntx - 1 do r.tsc[band(write + i, mask)] = now end
+   end
+   if r.tap ~= 0 then
+      for i = 0, ntx - 1 do capture.tap(r, array[i]) end
+   end
+   for i = 0, ntx - 1 do
+      local p = array[i]
+      r.packets[write] = p
+      bytes = bytes + p.length
+      write = band(write + 1, mask)
+   end
+   r.write = write
+   counter.add(r.stats.txpackets, ntx)
+   counter.add(r.stats.txbytes, bytes)
+   update_highwater(r)
+   if ntx < n then
+      counter.add(r.stats.txdrop, n - ntx)
+      for i = ntx, n - 1 do packet.free(array[i]) end
+   end
+   return ntx
+end
+
+-- Return a new array of n packet pointers for use with receive_batch
+-- and transmit_batch. The default, link.max, holds the contents of a
+-- default size link and is small enough to stay in cache; receive at
+-- most that many packets at a time into it.
+function new_batch (n)
+   return ffi.new(batch_t, n or max)
+end
+
 -- Return true if the ring is empty.
 function empty (r)
    return r.read == r.write
@@ -79,20 +215,21 @@ end
 
 -- Return true if the ring is full.
 function full (r)
-   return band(r.write + 1, size - 1) == r.read
+   return band(r.write + 1, r.mask) == r.read
 end
 
 -- Return the number of packets that are ready for read.
 function nreadable (r)
-   if r.read > r.write then
-      return r.write + size - r.read
-   else
-      return r.write - r.read
-   end
+   return band(r.write - r.read, r.mask)
+end
+
+-- Return the maximum number of packets that r can hold.
+function capacity (r)
+   return r.mask
 end
 
 function nwritable (r)
-   return max - nreadable(r)
+   return r.mask - nreadable(r)
 end
 
 function stats (r)
@@ -125,7 +262,74 @@ function selftest ()
       receive(r)
    end
    assert(counter.read(r.stats.rxpackets) == max)
+   -- Batched operations
+   local batch = new_batch()
+   for i = 0, max - 1 do
+      batch[i] = packet.allocate()
+      batch[i].length = i
+   end
+   assert(transmit_batch(r, batch, 10) == 10)
+   assert(nreadable(r) == 10)
+   assert(counter.read(r.stats.txbytes) == 45)
+   assert(transmit_batch(r, batch + 10, max - 10) == max - 10)
+   assert(full(r))
+   local extra = new_batch(2)
+   extra[0], extra[1] = packet.allocate(), packet.allocate()
+   assert(transmit_batch(r, extra, 2) == 0)
+   assert(counter.read(r.stats.txdrop) == 3)
+   local out = new_batch()
+   assert(receive_batch(r, out, 5) == 5)
+   assert(out[4].length == 4)
+   assert(receive_batch(r, out, max) == max - 5)
+   assert(empty(r))
+   assert(out[0].length == 5 and out[max-6].length == max - 1)
+   assert(counter.read(r.stats.rxpackets) == 2*max)
+   assert(counter.read(r.stats.capacity) == max)
+   assert(counter.read(r.stats.highwater) == max)
+   link.free(r, "test")
+   -- Links with a custom ring size
+   assert(not pcall(new, "test", 1000))
+   assert(not pcall(new, "test", C.LINK_MAX_RING_SIZE * 2))
+   local r = new("test", 8)
+   assert(capacity(r) == 7 and counter.read(r.stats.capacity) == 7)
+   for round = 1, 3 do
+      assert(transmit_batch(r, batch, 5) == 5)
+      assert(nreadable(r) == 5 and nwritable(r) == 2)
+      transmit(r, batch[5])
+      update_highwater(r)
+      assert(receive_batch(r, out, 8) == 6)
+      for i = 0, 5 do assert(out[i] == batch[i]) end
+   end
+   assert(counter.read(r.stats.highwater) == 6)
+   assert(transmit_batch(r, batch, 9) == 7 and full(r))
+   assert(counter.read(r.stats.txdrop) == 2)
+   assert(counter.read(r.stats.highwater) == 7)
+   link.free(r, "test") -- frees batch[0..6]
+   for i = 9, max - 1 do packet.free(batch[i]) end
+   -- Dwell-time measurement
+   local r = new("test", 8)
+   transmit(r, packet.allocate())
+   enable_dwell_timing(r, "test")
+   local h = histogram.open(dwell_histogram_name("test"))
+   transmit(r, packet.allocate())
+   extra[0], extra[1] = packet.allocate(), packet.allocate()
+   assert(transmit_batch(r, extra, 2) == 2)
+   packet.free(receive(r))
+   assert(receive_batch(r, out, 8) == 3)
+   for i = 0, 2 do packet.free(out[i]) end
+   assert(h.total == 4)
+   local total = 0
+   for count, lo, hi in h:iterate() do total = total + tonumber(count) end
+   assert(total == 4)
+   shm.unmap(h)
+   disable_dwell_timing(r, "test")
+   assert(r.tsc == nil and r.dwell == nil)
+   assert(not shm.exists(dwell_histogram_name("test")))
+   transmit(r, packet.allocate())
+   packet.free(receive(r))
+   enable_dwell_timing(r, "test")
    link.free(r, "test")
+   assert(not shm.exists(dwell_histogram_name("test")))
    print("selftest OK")
 end
 
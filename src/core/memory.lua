@@ -17,41 +17,69 @@ require("core.memory_h")
 
 --- ### Serve small allocations from hugepage "chunks"
 
--- List of all allocated huge pages: {pointer, physical, size, used}
--- The last element is used to service new DMA allocations.
+-- List of all allocated huge pages: {pointer, physical, size, used, node}
 chunks = {}
 
+-- NUMA node that new DMA memory is allocated for. Set by lib.numa
+-- (via packet.set_numa_node) when the process is bound to a node.
+numa_node = syscall.getcpu().node or 0
+
+-- Chunk used to service new DMA allocations, per NUMA node.
+local current_chunk = {}
+
+-- Huge page numbers (address / huge_page_size) of all chunks.
+local own_pages = {}
+
 -- Allocate DMA-friendly memory.
--- Return virtual memory pointer, physical address, and actual size.
+-- Return virtual memory pointer, physical address, actual size, and
+-- the NUMA node of the memory.
 function dma_alloc (bytes,  align)
    align = align or 128
    assert(bytes <= huge_page_size)
    -- Get current chunk of memory to allocate from
-   if #chunks == 0 then allocate_next_chunk() end
-   local chunk = chunks[#chunks]
+   local chunk = current_chunk[numa_node]
    -- Skip allocation forward pointer to suit alignment
-   chunk.used = lib.align(chunk.used, align)
+   if chunk then chunk.used = lib.align(chunk.used, align) end
    -- Need a new chunk to service this allocation?
-   if chunk.used + bytes > chunk.size then
-      allocate_next_chunk()
-      chunk = chunks[#chunks]
+   if not chunk or chunk.used + bytes > chunk.size then
+      chunk = allocate_next_chunk()
    end
    -- Slice out the memory we need
    local where = chunk.used
    chunk.used = chunk.used + bytes
-   return chunk.pointer + where, chunk.physical + where, bytes
+   return chunk.pointer + where, chunk.physical + where, bytes, chunk.node
 end
 
--- Add a new chunk.
+-- Add a new chunk for the current NUMA node and return it. The huge
+-- page is allocated subject to the NUMA memory policy of the process,
+-- so it is local to numa_node if the process is bound to it.
 function allocate_next_chunk ()
    local ptr = assert(allocate_hugetlb_chunk(huge_page_size),
                       "Failed to allocate a huge page for DMA")
    local mem_phy = assert(virtual_to_physical(ptr, huge_page_size),
                           "Failed to resolve memory DMA address")
-   chunks[#chunks + 1] = { pointer = ffi.cast("char*", ptr),
-                           physical = mem_phy,
-                           size = huge_page_size,
-                           used = 0 }
+   local chunk = { pointer = ffi.cast("char*", ptr),
+                   physical = mem_phy,
+                   size = huge_page_size,
+                   used = 0,
+                   node = numa_node }
+   chunks[#chunks + 1] = chunk
+   current_chunk[numa_node] = chunk
+   own_pages[tonumber(ffi.cast("uint64_t", ptr) / huge_page_size)] = chunk
+   return chunk
+end
+
+-- Record that the pages of all chunks were migrated to node (see
+-- lib.numa.bind_to_numa_node) and continue allocating from them.
+function migrate_chunks (node)
+   for _, chunk in ipairs(chunks) do chunk.node = node end
+   current_chunk[node] = current_chunk[node] or current_chunk[numa_node]
+end
+
+-- Return true if pointer is into a chunk allocated by this process.
+function is_own_chunk (pointer)
+   local page = ffi.cast("uint64_t", pointer) / huge_page_size
+   return own_pages[tonumber(page)] ~= nil
 end
 
 --- ### HugeTLB: Allocate contiguous memory in bulk from Linux
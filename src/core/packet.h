@@ -3,9 +3,43 @@
 // The maximum amount of payload in any given packet.
 enum { PACKET_PAYLOAD_SIZE = 10*1024 };
 
+// Bits of packet_md.valid: which metadata fields hold meaningful values.
+enum { PACKET_MD_HASH       = 0x01,   // hash
+       PACKET_MD_INPUT_PORT = 0x02,   // input_port
+       PACKET_MD_TIMESTAMP  = 0x04,   // timestamp
+       PACKET_MD_L2         = 0x08,   // ethertype, vlan
+       PACKET_MD_L3         = 0x10,   // l3_offset, l3_length
+       PACKET_MD_L4         = 0x20 }; // l4_offset, frag_offset, proto
+
+// Per-packet metadata filled in by the apps that parse or classify a
+// packet, so that apps further down the graph do not have to repeat
+// the work. Offsets are relative to the start of the packet data.
+// Shifting the data (shiftleft, shiftright, prepend) clears
+// PACKET_MD_L2, PACKET_MD_L3 and PACKET_MD_L4, and apps must parse the
+// packet again to restore them.
+struct packet_md {
+    uint16_t valid;            // PACKET_MD_* bits
+    uint16_t input_port;       // ingress port identifier
+    uint32_t hash;             // flow hash
+    uint64_t timestamp;        // receive timestamp
+    uint16_t ethertype;        // effective ethertype (after any 802.1q tag)
+    uint16_t vlan;             // 802.1q VID, 0 if untagged
+    int16_t  l3_offset;        // offset of the L3 header
+    int16_t  l4_offset;        // offset of the L4 header
+    uint16_t l3_length;        // L3 PDU length according to the L3 header
+    uint16_t frag_offset;      // IP fragment offset in 8-byte units
+    uint8_t  proto;            // upper layer protocol
+    uint8_t  reserved;
+    uint16_t scratch;          // private to the app that owns the packet
+} __attribute__((packed));
+
 // Packet of network data, with associated metadata.
 struct packet {
     uint16_t length;           // data payload length
+    uint16_t capacity;         // size of the data buffer (size class)
+    uint16_t refs;             // number of additional references
+    uint16_t node;             // NUMA node of the packet buffer
+    struct packet *next;       // next segment of a multi-segment packet
+    struct packet_md md;       // metadata, see above
     unsigned char data[PACKET_PAYLOAD_SIZE];
 };
-
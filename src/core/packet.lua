@@ -18,9 +18,37 @@ require("core.packet_h")
 
 local packet_t = ffi.typeof("struct packet")
 local packet_ptr_t = ffi.typeof("struct packet *")
-local packet_size = ffi.sizeof(packet_t)
+local header_size = ffi.offsetof(packet_t, "data")
 max_payload = tonumber(C.PACKET_PAYLOAD_SIZE)
 
+-- Bits of p.md.valid, see core/packet.h.
+md_hash       = tonumber(C.PACKET_MD_HASH)
+md_input_port = tonumber(C.PACKET_MD_INPUT_PORT)
+md_timestamp  = tonumber(C.PACKET_MD_TIMESTAMP)
+md_l2         = tonumber(C.PACKET_MD_L2)
+md_l3         = tonumber(C.PACKET_MD_L3)
+md_l4         = tonumber(C.PACKET_MD_L4)
+
+-- The metadata block lives in the packet structure, which moves around
+-- when headers are added or removed. It is saved here while the packet
+-- is being moved and restored at its new location.
+local md_t = ffi.typeof("struct packet_md")
+local md_size = ffi.sizeof(md_t)
+local md_saved = ffi.new(md_t)
+local md_headers = bit.bor(md_l2, md_l3, md_l4)
+
+-- Adding or removing headers (encapsulation, decapsulation, tag
+-- stripping) changes what the L2-L4 fields describe, so they are
+-- invalidated and have to be recomputed by whoever needs them.
+local function save_md (p)
+   ffi.copy(md_saved, p.md, md_size)
+   md_saved.valid = bit.band(md_saved.valid, bit.bnot(md_headers))
+end
+
+local function restore_md (p)
+   ffi.copy(p.md, md_saved, md_size)
+end
+
 -- For operations that add or remove headers from the beginning of a
 -- packet, instead of copying around the payload we just move the
 -- packet structure as a whole around.
@@ -51,7 +79,6 @@ local max_packets = 1e6
 
 ffi.cdef([[
 struct freelist {
-    int32_t lock[1];
     uint64_t nfree;
     uint64_t max;
     struct packet *list[]]..max_packets..[[];
@@ -84,76 +111,330 @@ local function freelist_nfree(freelist)
    return freelist.nfree
 end
 
-local function freelist_lock(freelist)
-   sync.lock(freelist.lock)
+-- Group freelist shared by the processes of a Snabb process group.
+--
+-- Processes exchange free packets in magazines: fixed-size bundles of
+-- packet pointers. Full and empty magazines are kept on two lock-free
+-- stacks, so a process moves a whole magazine to or from its own
+-- freelist with a single compare-and-swap and never waits on another
+-- process. A stack head packs the index of its top magazine plus one
+-- (0 if the stack is empty) in its lower 32 bits and a modification
+-- count in its upper 32 bits, which protects pop from the ABA problem.
+-- Magazines with an index at or above nused have never been used and
+-- are implicitly empty, so a zero-filled group freelist is valid.
+--
+-- The packets in a magazine all belong to the same NUMA node, and
+-- there is one stack of full magazines per node so that processes can
+-- prefer packets of their own node.
+
+local magazine_size = 256
+local nmagazines = math.floor(max_packets / magazine_size)
+local max_numa_nodes = 16
+
+ffi.cdef([[
+struct group_freelist {
+    uint64_t full[]]..max_numa_nodes..[[];
+    uint64_t empty[1];
+    int32_t nused[1];
+    uint32_t link[]]..nmagazines..[[];
+    struct packet *magazine[]]..nmagazines..[[][]]..magazine_size..[[];
+};
+]])
+
+local stack_top = 0xffffffffULL
+local stack_count = 0xffffffff00000000ULL
+
+local function stack_push (group_fl, head, m)
+   while true do
+      local h = head[0]
+      group_fl.link[m] = bit.band(h, stack_top)
+      local new = bit.bor(bit.band(h + 0x100000000ULL, stack_count), m + 1)
+      if sync.cas64(head, h, new) then return end
+   end
+end
+
+local function stack_pop (group_fl, head)
+   while true do
+      local h = head[0]
+      local top = tonumber(bit.band(h, stack_top))
+      if top == 0 then return nil end
+      -- The link may be stale if another process pops top concurrently,
+      -- in which case the modification count makes the CAS fail.
+      local new = bit.bor(bit.band(h + 0x100000000ULL, stack_count),
+                          group_fl.link[top - 1])
+      if sync.cas64(head, h, new) then return top - 1 end
+   end
+end
+
+-- Return the index of an empty magazine, or nil if there is none.
+local function group_empty_magazine (group_fl)
+   local m = stack_pop(group_fl, group_fl.empty)
+   if m then return m end
+   while true do
+      local nused = group_fl.nused[0]
+      if nused == nmagazines then return nil end
+      if sync.cas(group_fl.nused, nused, nused + 1) then return nused end
+   end
+end
+
+-- Move up to n packets from freelist to the group freelist, sorted
+-- into magazines by NUMA node. Packets that do not fill a magazine are
+-- put back onto freelist.
+local filling, nfilled = {}, {} -- NUMA node -> magazine, packets in it
+local function group_put (group_fl, freelist, n)
+   if n < magazine_size then return end
+   for _ = 1, n do
+      local p = freelist_remove(freelist)
+      local node = p.node
+      local m = filling[node]
+      if not m then
+         m = group_empty_magazine(group_fl)
+         if not m then freelist_add(freelist, p) break end
+         filling[node], nfilled[node] = m, 0
+      end
+      group_fl.magazine[m][nfilled[node]] = p
+      nfilled[node] = nfilled[node] + 1
+      if nfilled[node] == magazine_size then
+         stack_push(group_fl, group_fl.full + node, m)
+         filling[node] = nil
+      end
+   end
+   for node, m in pairs(filling) do
+      for i = 0, nfilled[node] - 1 do
+         freelist_add(freelist, group_fl.magazine[m][i])
+      end
+      stack_push(group_fl, group_fl.empty, m)
+      filling[node] = nil
+   end
+end
+
+-- Move a magazine of packets of NUMA node from the group freelist to
+-- freelist.
+local function group_get (group_fl, freelist, node)
+   local m = stack_pop(group_fl, group_fl.full + node)
+   if not m then return false end
+   local magazine = group_fl.magazine[m]
+   for i = 0, magazine_size - 1 do
+      freelist_add(freelist, magazine[i])
+   end
+   stack_push(group_fl, group_fl.empty, m)
+   return true
 end
 
-local function freelist_unlock(freelist)
-   sync.unlock(freelist.lock)
+-- Packets are allocated from pools of buffers of different size
+-- classes. The capacity field of a packet records the payload size of
+-- its class. Small packets in small buffers use less memory, cache and
+-- TLB entries than if every packet had room for max_payload bytes.
+local pools = {}              -- Ordered by payload size
+local pool_by_capacity = {}
+
+-- Packets of the local NUMA node are kept on freelist, packets of
+-- other nodes (received from processes on other nodes) on remote.
+local numa_node = memory.numa_node
+
+local function new_pool (payload, group_name)
+   local pool = { payload = payload,
+                  freelist = ffi.new("struct freelist", {max=max_packets}),
+                  remote = ffi.new("struct freelist", {max=max_packets}),
+                  group_name = group_name,
+                  group_fl = nil, -- Initialized on demand.
+                  allocated = 0,
+                  allocation_step = 1000 }
+   table.insert(pools, pool)
+   pool_by_capacity[payload] = pool
+   return pool
 end
 
-local packet_allocation_step = 1000
-local packets_allocated = 0
-local packets_fl = ffi.new("struct freelist", {max=max_packets})
-local group_fl -- Initialized on demand.
+local small_pool = new_pool(2048, "group/packets.2048.freelist")
+local default_pool = new_pool(max_payload, "group/packets.freelist")
+
+-- Return the pool of the smallest size class that fits size bytes.
+local function pool_for (size)
+   if size <= small_pool.payload then return small_pool
+   elseif size <= max_payload then return default_pool
+   else error("packet payload overflow") end
+end
 
 -- Call to ensure group freelist is enabled.
 function enable_group_freelist ()
-   if not group_fl then
-      group_fl = shm.create("group/packets.freelist", "struct freelist")
-      group_fl.max = max_packets
+   for _, pool in ipairs(pools) do
+      if not pool.group_fl then
+         pool.group_fl = shm.create(pool.group_name, "struct group_freelist")
+      end
    end
 end
 
--- Return borrowed packets to group freelist.
+-- Return borrowed packets and packets of remote NUMA nodes to group
+-- freelist.
 function rebalance_freelists ()
-   if group_fl and freelist_nfree(packets_fl) > packets_allocated then
-      freelist_lock(group_fl)
-      while freelist_nfree(packets_fl) > packets_allocated
-      and not freelist_full(group_fl) do
-         freelist_add(group_fl, freelist_remove(packets_fl))
+   for _, pool in ipairs(pools) do
+      local freelist, remote = pool.freelist, pool.remote
+      local group_fl = pool.group_fl
+      if group_fl then
+         group_put(group_fl, remote, tonumber(freelist_nfree(remote)))
+         group_put(group_fl, freelist,
+                   tonumber(freelist_nfree(freelist)) - pool.allocated)
       end
-      freelist_unlock(group_fl)
    end
 end
 
--- Return an empty packet.
-function allocate ()
-   if freelist_nfree(packets_fl) == 0 then
-      if group_fl then
-         freelist_lock(group_fl)
-         while freelist_nfree(group_fl) > 0
-         and freelist_nfree(packets_fl) < packets_allocated do
-            freelist_add(packets_fl, freelist_remove(group_fl))
-         end
-         freelist_unlock(group_fl)
+-- Refill the empty freelist of pool. Packets of the local NUMA node
+-- from the group freelist are preferred over new packets, and packets
+-- of remote nodes are only used when no more packets can be allocated.
+local function refill (pool)
+   local freelist, remote, group_fl = pool.freelist, pool.remote, pool.group_fl
+   if group_fl and group_get(group_fl, freelist, numa_node) then return end
+   if pool.allocated + pool.allocation_step <= max_packets then
+      preallocate_step(pool)
+      if freelist_nfree(freelist) > 0 then return end
+   end
+   if group_fl and freelist_nfree(remote) == 0 then
+      for node = 0, max_numa_nodes - 1 do
+         if group_get(group_fl, remote, node) then break end
       end
-      if freelist_nfree(packets_fl) == 0 then
-         preallocate_step()
+   end
+   counter.add(engine.remote_packets, freelist_nfree(remote))
+   while freelist_nfree(remote) > 0 do
+      freelist_add(freelist, freelist_remove(remote))
+   end
+end
+
+-- Return an empty packet. If size_hint is given the packet is taken
+-- from the smallest size class that can hold size_hint bytes,
+-- otherwise it can hold up to max_payload bytes.
+function allocate (size_hint)
+   local pool = size_hint and pool_for(size_hint) or default_pool
+   local freelist = pool.freelist
+   if freelist_nfree(freelist) == 0 then refill(pool) end
+   return freelist_remove(freelist)
+end
+
+-- Set the NUMA node of this process. New packets are allocated on
+-- node, and packets of other nodes are handed back to the processes of
+-- their node via the group freelist.
+--
+-- If migrated is true then the memory of the process was just moved to
+-- node, and its free packets are retagged and kept on the local
+-- freelists. (Packets in use at that time keep their old node.)
+function set_numa_node (node, migrated)
+   assert(node < max_numa_nodes, "unsupported NUMA node: "..node)
+   if migrated then
+      memory.migrate_chunks(node)
+      for _, pool in ipairs(pools) do
+         local freelist, remote = pool.freelist, pool.remote
+         for i = 0, tonumber(freelist_nfree(freelist)) - 1 do
+            local p = freelist.list[i]
+            if memory.is_own_chunk(p) then p.node = node end
+         end
+         local nremote = tonumber(freelist_nfree(remote))
+         remote.nfree = 0
+         for i = 0, nremote - 1 do
+            local p = remote.list[i]
+            if memory.is_own_chunk(p) then p.node = node end
+            if p.node == node then
+               freelist_add(freelist, p)
+            else
+               freelist_add(remote, p)
+            end
+         end
       end
    end
-   return freelist_remove(packets_fl)
+   numa_node = node
+   memory.numa_node = node
 end
 
 -- Create a new empty packet.
-function new_packet ()
-   local base = memory.dma_alloc(packet_size + packet_alignment,
-                                 packet_alignment)
+function new_packet (pool)
+   pool = pool or default_pool
+   local base, _, _, node =
+      memory.dma_alloc(header_size + pool.payload + packet_alignment,
+                       packet_alignment)
    local p = ffi.cast(packet_ptr_t, base + default_headroom)
    p.length = 0
+   p.capacity = pool.payload
+   p.refs = 0
+   p.node = node
+   p.next = nil
    return p
 end
 
--- Create an exact copy of a packet.
+-- Free a packet that is no longer in use.
+local function free_internal (p)
+   local ptr = ffi.cast("char*", p)
+   local capacity, node = p.capacity, p.node
+   p = ffi.cast(packet_ptr_t, ptr - get_headroom(ptr) + default_headroom)
+   p.length = 0
+   p.capacity = capacity
+   p.refs = 0
+   p.node = node
+   p.next = nil
+   p.md.valid = 0
+   local pool = capacity == max_payload and default_pool
+      or pool_by_capacity[capacity]
+   if node == numa_node then
+      freelist_add(pool.freelist, p)
+   else
+      freelist_add(pool.remote, p)
+   end
+end
+
+-- Free the segments of a multi-segment packet starting at p.
+local function free_segments (p, account)
+   repeat
+      local next = p.next
+      if account then counter.add(engine.freebytes, p.length) end
+      free_internal(p)
+      p = next
+   until p == nil
+end
+
+-- Create an exact copy of a packet, including its metadata and any
+-- further segments.
 function clone (p)
-   return from_pointer(p.data, p.length)
+   local c = append(allocate(p.capacity), p.data, p.length)
+   ffi.copy(c.md, p.md, md_size)
+   if p.next ~= nil then c.next = clone(p.next) end
+   return c
+end
+
+-- Packets can be shared by several holders, each of which must treat
+-- the packet as read-only and eventually free it. The buffer is only
+-- returned to the freelist when the last reference is freed.
+
+-- Add n (default 1) references to a packet and return it.
+function ref (p, n)
+   p.refs = p.refs + (n or 1)
+   return p
+end
+
+-- Return a packet with the contents of p that the caller may modify:
+-- p itself if the caller holds its only reference, otherwise a copy.
+function unshare (p)
+   if p.refs == 0 then return p end
+   p.refs = p.refs - 1
+   return clone(p)
+end
+
+-- Move the contents of a packet to a packet of a size class that can
+-- hold size bytes.
+local function promote (p, size)
+   local q = allocate(size)
+   ffi.copy(q.data, p.data, p.length)
+   q.length = p.length
+   q.next = p.next
+   ffi.copy(q.md, p.md, md_size)
+   free_internal(p)
+   return q
 end
 
 -- Append data to the end of a packet.
 function append (p, ptr, len)
-   assert(p.length + len <= max_payload, "packet payload overflow")
+   p = unshare(p)
+   local length = p.length + len
+   assert(length <= max_payload, "packet payload overflow")
+   if length > p.capacity then p = promote(p, length) end
    ffi.copy(p.data + p.length, ptr, len)
-   p.length = p.length + len
+   p.length = length
    return p
 end
 
@@ -168,58 +449,57 @@ end
 -- the header bytes at the front.
 function shiftleft (p, bytes)
    assert(0 <= bytes and bytes <= p.length)
+   p = unshare(p)
    local ptr = ffi.cast("char*", p)
    local len = p.length
+   local capacity, node, next = p.capacity, p.node, p.next
    local headroom = get_headroom(ptr)
+   save_md(p)
    if headroom_valid(bytes + headroom) then
       -- Fast path: just shift the packet pointer.
       p = ffi.cast(packet_ptr_t, ptr + bytes)
-      p.length = len - bytes
-      return p
    else
       -- Slow path: shift packet data, resetting the default headroom.
       local delta_headroom = default_headroom - headroom
       C.memmove(p.data + delta_headroom, p.data + bytes, len - bytes)
       p = ffi.cast(packet_ptr_t, ptr + delta_headroom)
-      p.length = len - bytes
-      return p
    end
+   p.length = len - bytes
+   p.capacity, p.refs, p.node, p.next = capacity, 0, node, next
+   restore_md(p)
+   return p
 end
 
 -- Move packet data to the right. This leaves length bytes of data
 -- at the beginning of the packet.
 function shiftright (p, bytes)
-   local ptr = ffi.cast("char*", p)
+   p = unshare(p)
    local len = p.length
+   assert(bytes <= max_payload - len)
+   if len + bytes > p.capacity then p = promote(p, len + bytes) end
+   local ptr = ffi.cast("char*", p)
+   local capacity, node, next = p.capacity, p.node, p.next
    local headroom = get_headroom(ptr)
+   save_md(p)
    if headroom_valid(headroom - bytes) then
       -- Fast path: just shift the packet pointer.
       p = ffi.cast(packet_ptr_t, ptr - bytes)
-      p.length = len + bytes
-      return p
    else
       -- Slow path: shift packet data, resetting the default headroom.
-      assert(bytes <= max_payload - len)
       local delta_headroom = default_headroom - headroom
       C.memmove(p.data + bytes + delta_headroom, p.data, len)
       p = ffi.cast(packet_ptr_t, ptr + delta_headroom)
-      p.length = len + bytes
-      return p
    end
+   p.length = len + bytes
+   p.capacity, p.refs, p.node, p.next = capacity, 0, node, next
+   restore_md(p)
+   return p
 end
 
 -- Conveniently create a packet by copying some existing data.
-function from_pointer (ptr, len) return append(allocate(), ptr, len) end
+function from_pointer (ptr, len) return append(allocate(len), ptr, len) end
 function from_string (d)         return from_pointer(d, #d) end
 
--- Free a packet that is no longer in use.
-local function free_internal (p)
-   local ptr = ffi.cast("char*", p)
-   p = ffi.cast(packet_ptr_t, ptr - get_headroom(ptr) + default_headroom)
-   p.length = 0
-   freelist_add(packets_fl, p)
-end   
-
 function account_free (p)
    counter.add(engine.frees)
    counter.add(engine.freebytes, p.length)
@@ -230,26 +510,102 @@ end
 
 function free (p)
    account_free(p)
-   free_internal(p)
+   if p.refs > 0 then
+      p.refs = p.refs - 1
+   else
+      if p.next ~= nil then free_segments(p.next, true) end
+      free_internal(p)
+   end
 end
 
 -- Set packet data length.
 function resize (p, len)
    assert(len <= max_payload, "packet payload overflow")
+   p = unshare(p)
+   if len > p.capacity then p = promote(p, len) end
    ffi.fill(p.data + p.length, math.max(0, len - p.length))
    p.length = len
    return p
 end
 
-function preallocate_step()
-   assert(packets_allocated + packet_allocation_step <= max_packets,
+-- Multi-segment packets are chains of packets linked by their next
+-- field. Most functions only look at the first segment of a packet;
+-- apps that need the whole payload in one buffer call linearize.
+
+-- Return the total payload length of all segments of a packet.
+function total_length (p)
+   local length = 0
+   repeat
+      length = length + p.length
+      p = p.next
+   until p == nil
+   return length
+end
+
+local function last_segment (p)
+   while p.next ~= nil do p = p.next end
+   return p
+end
+
+-- Add seg (and its further segments) to the end of packet p.
+function chain (p, seg)
+   p = unshare(p)
+   last_segment(p).next = seg
+   return p
+end
+
+-- Append data to the end of a packet, adding segments when the last
+-- segment is full. Unlike append, this never moves the first segment
+-- (unless it is shared).
+function append_chained (p, ptr, len)
+   p = unshare(p)
+   local seg = last_segment(p)
+   ptr = ffi.cast("uint8_t *", ptr)
+   while len > 0 do
+      if seg.length == seg.capacity then
+         seg.next = allocate()
+         seg = seg.next
+      end
+      local n = math.min(seg.capacity - seg.length, len)
+      ffi.copy(seg.data + seg.length, ptr, n)
+      seg.length = seg.length + n
+      ptr, len = ptr + n, len - n
+   end
+   return p
+end
+
+-- Return a single-segment packet with the payload of all segments of
+-- p. Takes ownership of p; single-segment packets are returned as is.
+function linearize (p)
+   if p.next == nil then return p end
+   local length = total_length(p)
+   assert(length <= max_payload, "packet payload overflow")
+   local q = allocate(length)
+   local seg = p
+   repeat
+      ffi.copy(q.data + q.length, seg.data, seg.length)
+      q.length = q.length + seg.length
+      seg = seg.next
+   until seg == nil
+   ffi.copy(q.md, p.md, md_size)
+   if p.refs > 0 then
+      p.refs = p.refs - 1
+   else
+      free_segments(p, false)
+   end
+   return q
+end
+
+function preallocate_step (pool)
+   pool = pool or default_pool
+   assert(pool.allocated + pool.allocation_step <= max_packets,
           "packet allocation overflow")
 
-   for i=1, packet_allocation_step do
-      free_internal(new_packet(), true)
+   for i=1, pool.allocation_step do
+      free_internal(new_packet(pool))
    end
-   packets_allocated = packets_allocated + packet_allocation_step
-   packet_allocation_step = 2 * packet_allocation_step
+   pool.allocated = pool.allocated + pool.allocation_step
+   pool.allocation_step = 2 * pool.allocation_step
 end
 
 function selftest ()
@@ -320,4 +676,144 @@ function selftest ()
                     default_headroom + 2, packet_alignment - 2)
    check_slow_shift(packet_alignment, shiftleft,
                     packet_alignment - default_headroom, default_headroom)
+
+   -- Metadata follows the packet through clones. Shifts keep the hash,
+   -- input port and timestamp but invalidate the L2-L4 fields.
+   local function check_md (shift, amount)
+      local p = allocate()
+      assert(p.md.valid == 0)
+      p.length = 400
+      p.md.valid = bit.bor(md_hash, md_timestamp, md_l2, md_l3, md_l4)
+      p.md.hash, p.md.l3_offset, p.md.l4_offset = 0xdeadbeef, 14, 34
+      local c = clone(p)
+      assert(c.md.valid == p.md.valid)
+      assert(c.md.hash == 0xdeadbeef and c.md.l4_offset == 34)
+      free(c)
+      p = shift(p, amount)
+      assert(p.md.valid == bit.bor(md_hash, md_timestamp))
+      assert(p.md.hash == 0xdeadbeef)
+      check_free(p)
+   end
+   check_md(shiftleft, 14)     -- fast path
+   check_md(shiftleft, 300)    -- slow path
+   check_md(shiftright, 10)    -- fast path
+   check_md(shiftright, 300)   -- slow path
+
+   -- Size classes: packets are promoted transparently when they grow.
+   local p = allocate(64)
+   assert(p.capacity == 2048)
+   assert(allocate(2049).capacity == max_payload)
+   assert(allocate().capacity == max_payload)
+   p.md.valid, p.md.hash = md_hash, 42
+   p = append(p, ffi.new("uint8_t[2000]", 7), 2000)
+   assert(p.capacity == 2048)
+   p = append(p, ffi.new("uint8_t[100]", 9), 100)
+   assert(p.capacity == max_payload and p.length == 2100)
+   assert(p.data[1999] == 7 and p.data[2000] == 9)
+   assert(p.md.valid == md_hash and p.md.hash == 42)
+   free(p)
+   p = resize(allocate(64), 4000)
+   assert(p.capacity == max_payload and p.length == 4000)
+   free(p)
+   p = allocate(64)
+   p.length = 2000
+   p = shiftright(p, 100)
+   assert(p.capacity == max_payload and p.length == 2100)
+   free(p)
+   p = allocate(64)
+   local c = clone(p)
+   assert(c.capacity == 2048)
+   free(c)
+   check_free(p)
+   assert(allocate(64) == p)
+   free(p)
+   local ok = pcall(allocate, max_payload + 1)
+   assert(not ok)
+
+   -- Multi-segment packets.
+   local nfree = freelist_nfree(default_pool.freelist)
+   local bytes = ffi.new("uint8_t[?]", 3 * max_payload)
+   for i = 0, 3 * max_payload - 1 do bytes[i] = i % 251 end
+   p = append_chained(allocate(), bytes, 2 * max_payload + 100)
+   assert(p.length == max_payload and p.next.length == max_payload)
+   assert(p.next.next.length == 100 and p.next.next.next == nil)
+   assert(total_length(p) == 2 * max_payload + 100)
+   p = shiftleft(p, 14)
+   assert(total_length(p) == 2 * max_payload + 86)
+   c = clone(p)
+   assert(total_length(c) == 2 * max_payload + 86)
+   assert(c.next.next.data[99] == bytes[2 * max_payload + 99])
+   assert(not pcall(linearize, c))
+   free(c)
+   free(p)
+   p = chain(from_pointer(bytes, 100), from_pointer(bytes + 100, 200))
+   p = chain(p, from_pointer(bytes + 300, 300))
+   p.md.valid = md_hash
+   p = linearize(p)
+   assert(p.next == nil and p.length == 600 and p.capacity == 2048)
+   assert(p.md.valid == md_hash)
+   for i = 0, 599 do assert(p.data[i] == bytes[i]) end
+   free(p)
+   assert(freelist_nfree(default_pool.freelist) == nfree)
+
+   -- Shared packets.
+   nfree = freelist_nfree(small_pool.freelist)
+   p = from_pointer(bytes, 100)
+   local r = ref(p)
+   assert(r == p and p.refs == 1)
+   r = shiftleft(r, 10)                 -- copy on write
+   assert(r ~= p and r.refs == 0 and p.refs == 0)
+   assert(p.length == 100 and r.length == 90 and r.data[0] == bytes[10])
+   free(r)
+   ref(p, 2)
+   free(p)
+   free(p)
+   assert(p.refs == 0 and unshare(p) == p)
+   free(p)
+   assert(freelist_nfree(small_pool.freelist) == nfree)
+
+   -- Free packets are reused after migrating to another NUMA node.
+   local node, other = numa_node, (numa_node + 1) % max_numa_nodes
+   local ps = {}
+   for i = 1, 100 do ps[i] = allocate(100) end
+   for i = 1, 100 do free(ps[i]) end
+   nfree = tonumber(freelist_nfree(small_pool.freelist))
+   set_numa_node(other)
+   for i = 1, 100 do ps[i] = allocate(100) end
+   for i = 1, 100 do free(ps[i]) end
+   assert(freelist_nfree(small_pool.freelist) == nfree - 100)
+   assert(freelist_nfree(small_pool.remote) >= 100)
+   local allocated = small_pool.allocated
+   set_numa_node(other, true)
+   assert(freelist_nfree(small_pool.remote) == 0)
+   assert(freelist_nfree(small_pool.freelist) == nfree)
+   for i = 1, nfree do
+      ps[i] = allocate(100)
+      assert(ps[i].node == other)
+   end
+   assert(small_pool.allocated == allocated)
+   for i = 1, nfree do free(ps[i]) end
+   set_numa_node(node, true)
+
+   -- Group freelist magazines.
+   local group_fl = ffi.new("struct group_freelist")
+   local fl = ffi.new("struct freelist", {max=max_packets})
+   for i = 1, 2 * magazine_size + 10 do
+      local p = new_packet(small_pool)
+      p.node = i % 2
+      freelist_add(fl, p)
+   end
+   group_put(group_fl, fl, tonumber(freelist_nfree(fl)))
+   assert(freelist_nfree(fl) == 10 and group_fl.nused[0] == 4)
+   assert(group_get(group_fl, fl, 1) and not group_get(group_fl, fl, 1))
+   assert(freelist_nfree(fl) == magazine_size + 10)
+   for i = 1, magazine_size do
+      p = freelist_remove(fl)
+      assert(p.node == 1)
+      freelist_add(fl, p)
+   end
+   group_put(group_fl, fl, magazine_size)
+   assert(freelist_nfree(fl) == 10 and group_fl.nused[0] == 4)
+   assert(group_get(group_fl, fl, 0) and group_get(group_fl, fl, 1))
+   assert(freelist_nfree(fl) == 2 * magazine_size + 10)
 end
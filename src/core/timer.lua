@@ -83,6 +83,168 @@ function new (name, fn, nanos, mode)
             repeating = (mode == 'repeating') }
 end
 
+-- Timing wheels
+--
+-- The timers above suit a few dozen timers with callbacks. For large
+-- numbers of timers (e.g. per-flow expiry) use a hierarchical timing
+-- wheel: its timers are FFI entries that carry a 64-bit datum instead
+-- of a callback, adding and cancelling a timer takes constant time,
+-- and expired timers are handed to a callback in batches.
+--
+--    wheel = new_wheel({capacity=N, now=T, batch=B})
+--    id = wheel:add(delay, data)       -- expires at now + delay ticks
+--    wheel:reschedule(id, delay)
+--    wheel:cancel(id)
+--    wheel:advance(T, function (batch, n) ... end)
+--
+-- Ticks are integers in units of the caller's choosing. Delays must be
+-- between 1 and 2^32-1 ticks. advance() moves the wheel to time T and
+-- calls its callback with a uint64_t array holding the data of up to B
+-- expired timers (zero-based) and their number. A batch can span several
+-- ticks, so wheel.now may be past the expiry of the timers in it (but
+-- never past T.) Timers may be added and cancelled from within the
+-- callback, relative to wheel.now.
+
+local band, rshift = bit.band, bit.rshift
+
+local wheel_bits, wheel_levels = 8, 4
+local wheel_size = 2^wheel_bits
+local wheel_mask = wheel_size - 1
+local NONE = 0xffff -- Slot of free entries
+
+local wheel_entry_t = ffi.typeof[[struct {
+   uint32_t next, prev; // Entry list links (0 is none)
+   uint32_t expiry;     // Expiry tick modulo 2^32
+   uint16_t slot;       // level * wheel_size + slot, or NONE
+   uint64_t data;
+}]]
+local wheel_entries_t = ffi.typeof("$[?]", wheel_entry_t)
+local wheel_heads_t = ffi.typeof("uint32_t[?]")
+local wheel_batch_t = ffi.typeof("uint64_t[?]")
+
+local Wheel = {}
+
+function new_wheel (conf)
+   local capacity = assert(conf.capacity, "capacity required")
+   local wheel = {
+      entries = wheel_entries_t(capacity + 1),
+      heads = wheel_heads_t(wheel_size * wheel_levels),
+      batch = wheel_batch_t(conf.batch or 256),
+      nbatch = conf.batch or 256,
+      now = conf.now or 0,
+      count = 0,
+      free = 1
+   }
+   -- Chain all entries (1..capacity) into the freelist.
+   local entries = wheel.entries
+   for id = 1, capacity do
+      entries[id].next = id < capacity and id + 1 or 0
+      entries[id].slot = NONE
+   end
+   return setmetatable(wheel, {__index = Wheel})
+end
+
+-- Link entry id into the slot for its expiry, which is delta ticks
+-- from now.
+local function wheel_insert (wheel, id, delta)
+   local e = wheel.entries[id]
+   local level = (delta < 2^8 and 0) or (delta < 2^16 and 1)
+      or (delta < 2^24 and 2) or 3
+   local slot = level * wheel_size
+      + band(rshift(e.expiry, level * wheel_bits), wheel_mask)
+   local head = wheel.heads[slot]
+   e.slot, e.prev, e.next = slot, 0, head
+   if head ~= 0 then wheel.entries[head].prev = id end
+   wheel.heads[slot] = id
+end
+
+-- Unlink entry id from its slot.
+local function wheel_unlink (wheel, id)
+   local entries = wheel.entries
+   local e = entries[id]
+   if e.prev ~= 0 then entries[e.prev].next = e.next
+   else wheel.heads[e.slot] = e.next end
+   if e.next ~= 0 then entries[e.next].prev = e.prev end
+end
+
+function Wheel:add (delay, data)
+   assert(delay >= 1 and delay < 2^32, "timer delay out of range")
+   local id = self.free
+   if id == 0 then error("timer wheel full") end
+   local e = self.entries[id]
+   self.free = e.next
+   e.expiry = (self.now + delay) % 2^32
+   e.data = data or 0
+   wheel_insert(self, id, delay)
+   self.count = self.count + 1
+   return id
+end
+
+function Wheel:reschedule (id, delay)
+   assert(delay >= 1 and delay < 2^32, "timer delay out of range")
+   local e = self.entries[id]
+   assert(e.slot ~= NONE, "timer not active")
+   wheel_unlink(self, id)
+   e.expiry = (self.now + delay) % 2^32
+   wheel_insert(self, id, delay)
+end
+
+function Wheel:cancel (id)
+   local e = self.entries[id]
+   assert(e.slot ~= NONE, "timer not active")
+   wheel_unlink(self, id)
+   e.slot, e.next = NONE, self.free
+   self.free = id
+   self.count = self.count - 1
+end
+
+function Wheel:advance (to, fn)
+   local entries, heads, batch = self.entries, self.heads, self.batch
+   local n = 0
+   while self.now < to do
+      if self.count == 0 then self.now = to break end
+      local now = self.now + 1
+      self.now = now
+      -- Cascade timers from the higher levels whose slots come due,
+      -- highest level first.
+      if band(now, wheel_mask) == 0 then
+         local level = 1
+         while level < wheel_levels - 1
+         and now % 2^((level + 1) * wheel_bits) == 0 do
+            level = level + 1
+         end
+         for l = level, 1, -1 do
+            local slot = l * wheel_size
+               + band(rshift(now, l * wheel_bits), wheel_mask)
+            local id = heads[slot]
+            while id ~= 0 do
+               local e = entries[id]
+               heads[slot] = e.next
+               if e.next ~= 0 then entries[e.next].prev = 0 end
+               wheel_insert(self, id, (e.expiry - now) % 2^32)
+               id = heads[slot]
+            end
+         end
+      end
+      -- Expire the timers of the current slot.
+      local slot = band(now, wheel_mask)
+      local id = heads[slot]
+      while id ~= 0 do
+         local e = entries[id]
+         heads[slot] = e.next
+         if e.next ~= 0 then entries[e.next].prev = 0 end
+         batch[n] = e.data
+         e.slot, e.next = NONE, self.free
+         self.free = id
+         self.count = self.count - 1
+         n = n + 1
+         if n == self.nbatch then fn(batch, n) n = 0 end
+         id = heads[slot]
+      end
+   end
+   if n > 0 then fn(batch, n) end
+end
+
 function selftest ()
    print("selftest: timer")
 
@@ -110,5 +272,69 @@ function selftest ()
    local elapsed_time = finish - start
    print(("ok (%s callbacks in %.4f seconds)"):format(
       lib.comma_value(count), elapsed_time))
+
+   print("selftest: timer wheel")
+   -- Compare against a reference of expiry ticks, with delays hitting
+   -- all levels and starting close to the 2^32 tick wrap-around.
+   local start_tick = 2^32 - 1000
+   local wheel = new_wheel({capacity=20000, now=start_tick, batch=7})
+   local expiry, ids = {}, {}
+   local function add (delay)
+      local data = #ids + 1
+      ids[data] = wheel:add(delay, data)
+      expiry[data] = wheel.now + delay
+   end
+   for _, delay in ipairs({1, 2, 255, 256, 257, 65535, 65536, 65537,
+                           2^24 - 1, 2^24, 2^24 + 1, 2^32 - 1}) do
+      add(delay)
+   end
+   for i = 1, 10000 do
+      add(math.random(2^(math.random(1, 26))))
+   end
+   -- Cancel and reschedule some.
+   local cancelled = {}
+   for data = 20, 2000, 20 do
+      wheel:cancel(ids[data])
+      cancelled[data], expiry[data] = true, nil
+   end
+   for data = 30, 3000, 30 do
+      if not cancelled[data] then
+         local delay = math.random(2^20)
+         wheel:reschedule(ids[data], delay)
+         expiry[data] = wheel.now + delay
+      end
+   end
+   assert(not pcall(wheel.cancel, wheel, ids[20]))
+   local expired, last, t = 0, start_tick, start_tick
+   local function check (batch, n)
+      assert(n >= 1 and n <= 7)
+      for i = 0, n - 1 do
+         local data = tonumber(batch[i])
+         assert(not cancelled[data], "cancelled timer expired")
+         assert(expiry[data] > last and expiry[data] <= t,
+                "timer expired at wrong tick")
+         expiry[data] = nil
+         expired = expired + 1
+         -- Add timers from within the callback.
+         if expired % 100 == 0 then add(math.random(2^16)) end
+      end
+   end
+   while wheel.count > 0 and t < start_tick + 2^27 do
+      last, t = t, t + math.random(2^12)
+      wheel:advance(t, check)
+   end
+   for data = 1, #ids do
+      assert(not expiry[data] or expiry[data] > 2^27 + start_tick,
+             "timer did not expire")
+   end
+   -- Full wheel.
+   local small = new_wheel({capacity=2})
+   small:add(1) small:add(1)
+   assert(not pcall(small.add, small, 1))
+   small:advance(1, function () end)
+   assert(small.count == 0)
+   small:add(1)
+   assert(wheel.count == 1) -- delay 2^32-1
+   print(("ok (%s timers expired)"):format(lib.comma_value(expired)))
 end
 
@@ -0,0 +1,303 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(...,package.seeall)
+
+-- CAPTURE: copy packets transmitted on a running engine's links to pcap
+--
+-- A capture is a shared memory object that a separate process (e.g.
+-- “snabb capture”) creates under captures/ in the SHM tree of a running
+-- Snabb instance to request packets from one of its links. The engine
+-- polls for requests, arms a tap on the named link, and copies packets
+-- transmitted onto the link (that match an optional pflua filter) into
+-- a single-producer/single-consumer ring in the capture object, until
+-- the optional packet or byte budget is used up. The requesting process
+-- drains the ring into a pcap file and unlinks the capture once it is
+-- done, which makes the engine disarm the tap.
+--
+-- Links with no armed tap pay a single branch per transmit call (see
+-- core.link).
+--
+-- API
+-- ----
+--
+--    request(pid, linkspec, conf)
+--       Requests a capture of packets transmitted onto the link linkspec
+--       of the Snabb instance pid. Conf may contain filter (a pflua
+--       expression), packets and bytes (the budget; default unlimited).
+--       Returns the capture object and its SHM name.
+--
+--    drain(cap, file)
+--       Writes the packets captured in cap to the pcap file (see
+--       lib.pcap.pcap) and returns their number.
+--
+--    done(cap)
+--       Returns true if the engine has stopped capturing into cap, and an
+--       error message if the request failed.
+--
+--    poll(links)
+--       Arms and disarms taps for the capture requests to this process.
+--       Links maps link names to links. Called periodically by the
+--       engine.
+--
+--    tap(r, p)
+--       Copies packet p to the capture armed on link r (if it matches the
+--       filter). Called by core.link for links with an armed tap.
+
+local ffi = require("ffi")
+local C = ffi.C
+local shm = require("core.shm")
+local packet = require("core.packet")
+local pcap = require("lib.pcap.pcap")
+local S = require("syscall")
+local band = require("bit").band
+local floor, min = math.floor, math.min
+
+local SIZE = 256 -- Capture ring size (must be a power of two.)
+local SNAPLEN = packet.max_payload
+
+assert(band(SIZE, SIZE-1) == 0, "SIZE is not a power of two")
+
+ffi.cdef([[ struct capture_record {
+   uint32_t ts_sec, ts_usec, incl_len, orig_len;
+   uint8_t data[]]..SNAPLEN..[[];
+};
+struct capture {
+   int state;
+   char linkspec[256], filter[1024], error[256];
+   uint64_t max_packets, max_bytes;
+   uint64_t packets, bytes, dropped;
+   int read;
+   char pad1[60];
+   int write;
+   char pad2[60];
+   struct capture_record records[]]..SIZE..[[];
+} __attribute__((aligned(64)));]])
+
+local capture_t = ffi.typeof("struct capture")
+
+-- A capture is filled in by the requesting process (INIT), which marks
+-- it REQUESTED once it is complete. The engine moves it to ARMED or
+-- FAILED, and from ARMED to DONE once the budget is used up or the link
+-- disappears.
+local INIT      = 0
+local REQUESTED = 1
+local ARMED     = 2
+local DONE      = 3
+local FAILED    = 4
+
+function request (pid, linkspec, conf)
+   conf = conf or {}
+   local name = "/"..pid.."/captures/"..S.getpid()..".capture"
+   local cap = shm.create(name, capture_t)
+   assert(#linkspec < ffi.sizeof(cap.linkspec), "link name too long")
+   assert(#(conf.filter or "") < ffi.sizeof(cap.filter), "filter too long")
+   ffi.copy(cap.linkspec, linkspec)
+   ffi.copy(cap.filter, conf.filter or "")
+   cap.max_packets = conf.packets or 0
+   cap.max_bytes = conf.bytes or 0
+   C.full_memory_barrier()
+   cap.state = REQUESTED
+   return cap, name
+end
+
+function drain (cap, file)
+   local read, n = cap.read, 0
+   while read ~= cap.write do
+      local record = cap.records[read]
+      pcap.write_record_header(file, record.incl_len, record.orig_len,
+                               record.ts_sec, record.ts_usec)
+      file:write(ffi.string(record.data, record.incl_len))
+      read, n = band(read + 1, SIZE - 1), n + 1
+      C.full_memory_barrier()
+      cap.read = read
+   end
+   if n > 0 then file:flush() end
+   return n
+end
+
+function done (cap)
+   if cap.state == FAILED then return true, ffi.string(cap.error) end
+   return cap.state == DONE and cap.read == cap.write
+end
+
+-- Taps indexed by link.tap, and capture requests by SHM name.
+local taps, active = {}, {}
+
+local function fail (cap, message)
+   ffi.copy(cap.error, message:sub(1, ffi.sizeof(cap.error) - 1))
+   cap.state = FAILED
+end
+
+local function arm (cap, links)
+   local linkspec = ffi.string(cap.linkspec)
+   local r = links[linkspec]
+   if not r then return fail(cap, "no such link: "..linkspec) end
+   if r.tap ~= 0 then return fail(cap, "link already tapped: "..linkspec) end
+   local filter = nil
+   if cap.filter[0] ~= 0 then
+      local ok, result = pcall(require("pf").compile_filter,
+                               ffi.string(cap.filter))
+      if not ok then return fail(cap, tostring(result)) end
+      filter = result
+   end
+   local index = 1
+   while taps[index] do index = index + 1 end
+   taps[index] = {cap=cap, filter=filter}
+   r.tap = index
+   cap.state = ARMED
+   return {index=index, link=r}
+end
+
+local function disarm (t)
+   if t.link.tap == t.index then t.link.tap = 0 end
+   taps[t.index] = nil
+end
+
+function poll (links)
+   local requests = {}
+   for _, file in ipairs(shm.children("captures")) do
+      requests["captures/"..file] = true
+   end
+   -- Forget captures that have been unlinked by their readers.
+   for name, a in pairs(active) do
+      if not requests[name] then
+         if a.tap then disarm(a.tap) end
+         shm.unmap(a.cap)
+         active[name] = nil
+      elseif a.tap and a.tap.link.tap ~= a.tap.index then
+         -- Budget used up or link freed.
+         disarm(a.tap)
+         a.tap = nil
+         a.cap.state = DONE
+      end
+   end
+   for name in pairs(requests) do
+      if not active[name] then
+         local cap = shm.open(name, capture_t)
+         if cap.state == REQUESTED then
+            active[name] = {cap=cap, tap=arm(cap, links)}
+         else
+            shm.unmap(cap) -- Not ready yet, retry on next poll.
+         end
+      end
+   end
+end
+
+function tap (r, p)
+   local t = taps[r.tap]
+   if not t then return end
+   if t.filter and not t.filter(p.data, p.length) then return end
+   local cap = t.cap
+   local write = cap.write
+   local nwrite = band(write + 1, SIZE - 1)
+   if nwrite == cap.read then
+      cap.dropped = cap.dropped + 1
+      return
+   end
+   local record = cap.records[write]
+   local time = C.get_unix_time()
+   record.ts_sec = floor(time)
+   record.ts_usec = (time - floor(time)) * 1e6
+   local length, seg = 0, p
+   repeat
+      local n = min(seg.length, SNAPLEN - length)
+      ffi.copy(record.data + length, seg.data, n)
+      length = length + n
+      seg = seg.next
+   until seg == nil or length == SNAPLEN
+   record.incl_len = length
+   record.orig_len = packet.total_length(p)
+   C.full_memory_barrier()
+   cap.write = nwrite
+   cap.packets = cap.packets + 1
+   cap.bytes = cap.bytes + record.orig_len
+   if (cap.max_packets > 0 and cap.packets >= cap.max_packets)
+   or (cap.max_bytes > 0 and cap.bytes >= cap.max_bytes) then
+      r.tap = 0 -- Cleaned up by poll.
+   end
+end
+
+function selftest ()
+   print("selftest: lib.capture")
+   local link = require("core.link")
+   local pid = S.getpid()
+   local r = link.new("capture_test")
+   local links = {capture_test=r}
+   local function send (length)
+      local p = packet.allocate()
+      p.length = length
+      p.data[12], p.data[13] = 0x08, 0x00 -- IPv4 ethertype
+      link.transmit(r, p)
+   end
+   local function receive_all ()
+      while not link.empty(r) do packet.free(link.receive(r)) end
+   end
+   -- Packet budget and filter
+   local cap, name = request(pid, "capture_test", {filter="ip", packets=3})
+   send(60)
+   poll(links)
+   assert(cap.state == ARMED and r.tap ~= 0)
+   send(64)
+   send(65)
+   local p = packet.allocate()
+   p.length = 60 -- Not IPv4
+   link.transmit(r, p)
+   local p = packet.allocate()
+   p.length = 100
+   p.data[12], p.data[13] = 0x08, 0x00
+   link.transmit(r, packet.chain(p, packet.from_string(("x"):rep(50))))
+   send(66)
+   receive_all()
+   assert(r.tap == 0 and cap.packets == 3)
+   poll(links)
+   local path = os.tmpname()
+   local file = io.open(path, "w")
+   pcap.write_file_header(file)
+   assert(not done(cap))
+   assert(drain(cap, file) == 3)
+   assert(done(cap))
+   file:close()
+   local lengths = {}
+   for data, record in pcap.records(path) do
+      assert(#data == record.incl_len)
+      table.insert(lengths, record.orig_len)
+      assert(record.ts_sec > 0)
+   end
+   assert(#lengths == 3)
+   assert(lengths[1] == 64 and lengths[2] == 65 and lengths[3] == 150)
+   os.remove(path)
+   shm.unmap(cap)
+   shm.unlink(name)
+   poll(links)
+   assert(not next(active) and not next(taps))
+   -- Failures
+   local cap, name = request(pid, "nosuchlink")
+   poll(links)
+   local _, err = done(cap)
+   assert(cap.state == FAILED and err:match("no such link"))
+   shm.unmap(cap)
+   shm.unlink(name)
+   poll(links)
+   local cap, name = request(pid, "capture_test", {filter="not a filter("})
+   poll(links)
+   assert(cap.state == FAILED and r.tap == 0)
+   shm.unmap(cap)
+   shm.unlink(name)
+   poll(links)
+   -- Ring overflow, and link freed while armed
+   local cap, name = request(pid, "capture_test")
+   poll(links)
+   for i = 1, SIZE + 10 do
+      send(60)
+      receive_all()
+   end
+   assert(cap.packets == SIZE - 1 and cap.dropped == 11)
+   link.free(r, "capture_test")
+   poll(links)
+   assert(cap.state == DONE)
+   shm.unmap(cap)
+   shm.unlink(name)
+   poll(links)
+   assert(not next(active) and not next(taps))
+   print("selftest ok")
+end
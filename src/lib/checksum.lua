@@ -8,7 +8,8 @@ require("lib.checksum_h")
 local lib = require("core.lib")
 local ffi = require("ffi")
 local C = ffi.C
-local band, lshift = bit.band, bit.lshift
+local band, bnot, lshift, rshift = bit.band, bit.bnot, bit.lshift, bit.rshift
+local htons, ntohs, ntohl = lib.htons, lib.ntohs, lib.ntohl
 
 -- Select ipsum(pointer, len, initial) function based on hardware
 -- capability.
@@ -98,6 +99,111 @@ function prepare_packet6 (buf, len)
   return prepare_packet_l4( buf, len, csum_start, csum_off)
 end
 
+-- Incremental update of a checksum for a change to some of the data it
+-- covers, without going over the rest of the data again (RFC 1624).
+-- Checksums and field values are in host byte order.
+
+local uint16_ptr_t = ffi.typeof("uint16_t *")
+local uint32_ptr_t = ffi.typeof("uint32_t *")
+
+local function rd16 (ptr) return ntohs(ffi.cast(uint16_ptr_t, ptr)[0]) end
+local function wr16 (ptr, val) ffi.cast(uint16_ptr_t, ptr)[0] = htons(val) end
+
+-- Two rounds of end-around carry are enough for sums of a few dozen
+-- 16-bit words.
+local function fold (sum)
+   sum = band(sum, 0xffff) + rshift(sum, 16)
+   return band(sum, 0xffff) + rshift(sum, 16)
+end
+
+-- RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m').
+function update16 (csum, old, new)
+   local sum = band(bnot(csum), 0xffff) + band(bnot(old), 0xffff) + new
+   return band(bnot(fold(sum)), 0xffff)
+end
+
+function update32 (csum, old, new)
+   local sum = band(bnot(csum), 0xffff)
+      + band(bnot(old), 0xffff) + rshift(bnot(old), 16)
+      + band(new, 0xffff) + rshift(new, 16)
+   return band(bnot(fold(sum)), 0xffff)
+end
+
+-- OLD and NEW point to 16 bytes in network byte order, e.g. IPv6
+-- addresses.
+function update128 (csum, old, new)
+   old, new = ffi.cast(uint16_ptr_t, old), ffi.cast(uint16_ptr_t, new)
+   local sum = band(bnot(csum), 0xffff)
+   for i = 0, 7 do
+      sum = sum + band(bnot(ntohs(old[i])), 0xffff) + ntohs(new[i])
+   end
+   return band(bnot(fold(sum)), 0xffff)
+end
+
+-- Offset of the checksum in an L4 header covering the IP pseudo-header,
+-- if any: TCP, UDP and ICMPv6.
+local function l4_checksum_offset (proto)
+   if     proto == 6  then return 16
+   elseif proto == 17 then return 6
+   elseif proto == 58 then return 2
+   end
+end
+
+-- Apply UPDATE(csum, OLD, NEW) to the checksum of the L4 header at L4,
+-- of protocol PROTO.  A UDP checksum of zero means that there is none,
+-- so leave it alone, and never compute one of zero.
+local function update_l4 (l4, proto, update, old, new)
+   local offset = l4_checksum_offset(proto)
+   if not offset then return end
+   local csum = rd16(l4 + offset)
+   if proto == 17 and csum == 0 then return end
+   csum = update(csum, old, new)
+   if proto == 17 and csum == 0 then csum = 0xffff end
+   wr16(l4 + offset, csum)
+end
+
+local function set_ipv4_address (ip, offset, addr)
+   ip = ffi.cast("uint8_t *", ip)
+   local field = ffi.cast(uint32_ptr_t, ip + offset)
+   local old = ntohl(field[0])
+   field[0] = ffi.cast(uint32_ptr_t, addr)[0]
+   local new = ntohl(field[0])
+   wr16(ip + 10, update32(rd16(ip + 10), old, new))
+   -- Only the first fragment carries the L4 header.
+   if band(rd16(ip + 6), 0x1fff) == 0 then
+      update_l4(ip + band(ip[0], 0x0f) * 4, ip[9], update32, old, new)
+   end
+end
+
+-- Set the source or destination address of the IPv4 header at IP to
+-- the 4 bytes at ADDR, fixing up the header checksum and the TCP or UDP
+-- checksum.
+function set_ipv4_src (ip, addr) set_ipv4_address(ip, 12, addr) end
+function set_ipv4_dst (ip, addr) set_ipv4_address(ip, 16, addr) end
+
+local function set_ipv6_address (ip, offset, addr)
+   ip = ffi.cast("uint8_t *", ip)
+   update_l4(ip + 40, ip[6], update128, ip + offset, addr)
+   ffi.copy(ip + offset, addr, 16)
+end
+
+-- Set the source or destination address of the IPv6 header at IP to
+-- the 16 bytes at ADDR, fixing up the TCP, UDP or ICMPv6 checksum if
+-- that header follows directly.
+function set_ipv6_src (ip, addr) set_ipv6_address(ip, 8, addr) end
+function set_ipv6_dst (ip, addr) set_ipv6_address(ip, 24, addr) end
+
+local function set_port (l4, proto, offset, port)
+   l4 = ffi.cast("uint8_t *", l4)
+   update_l4(l4, proto, update16, rd16(l4 + offset), port)
+   wr16(l4 + offset, port)
+end
+
+-- Set the source or destination port of the TCP or UDP header at L4,
+-- of protocol PROTO, to PORT, fixing up its checksum.
+function set_l4_src_port (l4, proto, port) set_port(l4, proto, 0, port) end
+function set_l4_dst_port (l4, proto, port) set_port(l4, proto, 2, port) end
+
 -- See checksum.h for more utility functions that can be added.
 
 function selftest ()
@@ -121,6 +227,7 @@ function selftest ()
    if have_avx2 then print("avx2: "..avx2ok.."/"..tests) else print("no avx2") end
    if have_sse2 then print("sse2: "..sse2ok.."/"..tests) else print("no sse2") end
    selftest_ipv4_tcp()
+   selftest_incremental()
    assert(not have_avx2 or avx2ok == tests, "AVX2 test failed")
    assert(not have_sse2 or sse2ok == tests, "SSE2 test failed")
    print("selftest: ok")
@@ -132,3 +239,106 @@ function selftest_ipv4_tcp ()
    local data = lib.hexundump(s, 1500)
    assert(verify_packet(ffi.cast("char*",data), #data), "TCP/IPv4 checksum validation failed")
 end
+
+function selftest_incremental ()
+   print("selftest: incremental update")
+   -- Change a random 16, 32 or 128-bit field and compare with the
+   -- checksum computed from scratch.
+   local n = 64
+   local buf = ffi.new("uint8_t[?]", n)
+   for _ = 1, 10000 do
+      ffi.copy(buf, lib.random_bytes(n), n)
+      local csum = ipsum(buf, n, 0)
+      local size = ({2, 4, 16})[math.random(3)]
+      local offset = 2 * math.random(0, (n - size) / 2)
+      local new = lib.random_bytes(size)
+      if size == 2 then
+         csum = update16(csum, rd16(buf + offset), rd16(new))
+      elseif size == 4 then
+         csum = update32(csum, ntohl(ffi.cast(uint32_ptr_t, buf + offset)[0]),
+                         ntohl(ffi.cast(uint32_ptr_t, new)[0]))
+      else
+         csum = update128(csum, buf + offset, new)
+      end
+      ffi.copy(buf + offset, new, size)
+      assert(csum == ipsum(buf, n, 0), "incremental update, size "..size)
+   end
+
+   -- Rewrite addresses and ports of IPv4 and IPv6 packets, and check
+   -- that both the IPv4 header and the L4 checksums remain valid.
+   local function pseudo_header_sum (ip, ipv, proto, len)
+      local ph = ffi.new("uint8_t[40]")
+      if ipv == 4 then
+         ffi.copy(ph, ip + 12, 8)
+         ph[9] = proto
+         wr16(ph + 10, len)
+         return band(bnot(ipsum(ph, 12, 0)), 0xffff)
+      else
+         ffi.copy(ph, ip + 8, 32)
+         wr16(ph + 34, len)
+         ph[39] = proto
+         return band(bnot(ipsum(ph, 40, 0)), 0xffff)
+      end
+   end
+   local len = 100
+   local pkt = ffi.new("uint8_t[?]", 40 + len)
+   for _, ipv in ipairs({4, 6}) do
+      for _, proto in ipairs(ipv == 4 and {6, 17, 1} or {6, 17, 58}) do
+         for _, fragment in ipairs(ipv == 4 and {false, true} or {false}) do
+            local hlen = ipv == 4 and 20 or 40
+            local ip, l4 = pkt, pkt + hlen
+            ffi.copy(pkt, lib.random_bytes(hlen + len), hlen + len)
+            local offset = l4_checksum_offset(proto)
+            if ipv == 4 then
+               pkt[0], pkt[9] = 0x45, proto
+               wr16(pkt + 2, hlen + len)
+               wr16(pkt + 6, fragment and 0x2001 or 0)
+               wr16(pkt + 10, 0)
+               wr16(pkt + 10, ipsum(pkt, hlen, 0))
+            else
+               pkt[0], pkt[6] = 0x60, proto
+               wr16(pkt + 4, len)
+            end
+            if offset then
+               wr16(l4 + offset, 0)
+               wr16(l4 + offset,
+                    ipsum(l4, len, pseudo_header_sum(ip, ipv, proto, len)))
+            end
+            local payload = ffi.new("uint8_t[?]", len)
+            ffi.copy(payload, l4, len)
+            for _ = 1, 100 do
+               local choice = math.random(4)
+               if choice == 1 then
+                  local set = ipv == 4 and set_ipv4_src or set_ipv6_src
+                  set(ip, lib.random_bytes(ipv == 4 and 4 or 16))
+               elseif choice == 2 then
+                  local set = ipv == 4 and set_ipv4_dst or set_ipv6_dst
+                  set(ip, lib.random_bytes(ipv == 4 and 4 or 16))
+               elseif (proto == 6 or proto == 17) and not fragment then
+                  local set = choice == 3 and set_l4_src_port or set_l4_dst_port
+                  local port = math.random(0, 0xffff)
+                  set(l4, proto, port)
+                  assert(rd16(l4 + (choice - 3) * 2) == port)
+                  ffi.copy(payload + (choice - 3) * 2, l4 + (choice - 3) * 2, 2)
+               end
+               if ipv == 4 then
+                  assert(ipsum(ip, hlen, 0) == 0, "IPv4 header checksum")
+               end
+               if fragment or not offset then
+                  assert(C.memcmp(payload, l4, len) == 0, "L4 header changed")
+               else
+                  assert(ipsum(l4, len, pseudo_header_sum(ip, ipv, proto, len))
+                            == 0, "L4 checksum, IPv"..ipv..", proto "..proto)
+               end
+            end
+         end
+      end
+   end
+   -- A UDP packet without checksum stays that way.
+   pkt[0], pkt[9] = 0x45, 17
+   wr16(pkt + 6, 0)
+   wr16(pkt + 20 + 6, 0)
+   set_ipv4_src(pkt, lib.random_bytes(4))
+   set_l4_dst_port(pkt + 20, 17, 1234)
+   assert(rd16(pkt + 20 + 6) == 0, "UDP without checksum")
+end
@@ -4,13 +4,21 @@ local ffi = require("ffi")
 local C = ffi.C
 local S = require("syscall")
 local lib = require("core.lib")
+local shm = require("core.shm")
 local binary_search = require("lib.binary_search")
+local linear_search = require("lib.linear_search")
 local multi_copy = require("lib.multi_copy")
 local siphash = require("lib.hash.siphash")
+local crc32c = require("lib.hash.crc32c")
+local aes = require("lib.hash.aes")
+local band = require("bit").band
 local min, max, floor, ceil = math.min, math.max, math.floor, math.ceil
 
 CTable = {}
 LookupStreamer = {}
+SharedCTable = setmetatable({}, { __index = CTable })
+SharedCTableReader = {}
+SharedLookupStreamer = {}
 
 local HASH_MAX = 0xFFFFFFFF
 local uint8_ptr_t = ffi.typeof('uint8_t*')
@@ -18,46 +26,101 @@ local uint16_ptr_t = ffi.typeof('uint16_t*')
 local uint32_ptr_t = ffi.typeof('uint32_t*')
 local uint64_ptr_t = ffi.typeof('uint64_t*')
 
-local function compute_hash_fn(key_ctype, seed)
+-- Hash functions for keys, selected with the hash_function parameter.
+-- SipHash resists hash flooding and is the default.  CRC32C and AES
+-- are much cheaper, but an attacker who can choose keys can make them
+-- collide, so only use them for trusted keys.  Saved and shared tables
+-- record the ID of their hash function.
+local hash_functions = {
+   siphash = { id = 0, module = siphash, opts = {c=1, d=2},
+               available = true },
+   crc32c = { id = 1, module = crc32c, opts = {},
+              available = crc32c.available },
+   aes = { id = 2, module = aes, opts = {},
+           available = aes.available }
+}
+local hash_function_names = {}
+for name, hash in pairs(hash_functions) do
+   hash_function_names[hash.id] = name
+end
+
+local function hash_function_id(name)
+   local hash = hash_functions[name]
+   if not hash then error('unknown hash function: '..tostring(name)) end
+   return hash.id
+end
+
+
+-- Fail early, rather than on the first hash, if the CPU lacks the
+-- instructions that a hash function needs.
+local function check_hash_function(name)
+   hash_function_id(name)
+   if not hash_functions[name].available then
+      error('hash function not supported by this CPU: '..name)
+   end
+end
+
+local function hash_function_name(id)
+   return hash_function_names[id] or error('unknown hash function ID: '..id)
+end
+
+local function hash_module(name, opts)
+   hash_function_id(name)
+   local hash = hash_functions[name]
+   for k, v in pairs(hash.opts) do opts[k] = v end
+   return hash.module, opts
+end
+
+local function compute_hash_fn(key_ctype, seed, hash_function)
    if tonumber(ffi.new(key_ctype)) then
-      return siphash.make_u64_hash({c=1, d=2, key=seed})
+      local module, opts = hash_module(hash_function, {key=seed})
+      return module.make_u64_hash(opts)
    else
-      return siphash.make_hash({c=1, d=2, size=ffi.sizeof(key_ctype),
-                                key=seed})
+      local module, opts = hash_module(
+         hash_function, {size=ffi.sizeof(key_ctype), key=seed})
+      return module.make_hash(opts)
    end
 end
 
-local function compute_multi_hash_fn(key_ctype, width, stride, seed)
+local function compute_multi_hash_fn(key_ctype, width, stride, seed,
+                                     hash_function)
    if tonumber(ffi.new(key_ctype)) then
       -- We could fix this, but really it would be nicest to prohibit
       -- scalar keys.
       error('streaming lookup not available for scalar keys')
    end
-   return siphash.make_multi_hash({c=1, d=2, size=ffi.sizeof(key_ctype),
-                                   width=width, stride=stride, key=seed})
+   local module, opts = hash_module(
+      hash_function,
+      {size=ffi.sizeof(key_ctype), width=width, stride=stride, key=seed})
+   return module.make_multi_hash(opts)
 end
 
-local entry_types = {}
-local function make_entry_type(key_type, value_type)
-   local cache = entry_types[key_type]
+-- With aging, entries also carry the table time when they were last
+-- touched; see CTable:set_time.
+local entry_types = { [false] = {}, [true] = {} }
+local function make_entry_type(key_type, value_type, aging)
+   aging = aging and true or false
+   local cache = entry_types[aging][key_type]
    if cache then
       cache = cache[value_type]
       if cache then return cache end
    else
-      entry_types[key_type] = {}
+      entry_types[aging][key_type] = {}
    end
    local raw_size = ffi.sizeof(key_type) + ffi.sizeof(value_type) + 4
+   if aging then raw_size = raw_size + 4 end
    local padding = 2^ceil(math.log(raw_size)/math.log(2)) - raw_size
    local ret = ffi.typeof([[struct {
          uint32_t hash;
          $ key;
          $ value;
+         ]]..(aging and 'uint32_t timestamp;' or '')..[[
          uint8_t padding[$];
       } __attribute__((packed))]],
       key_type,
       value_type,
       padding)
-   entry_types[key_type][value_type] = ret
+   entry_types[aging][key_type][value_type] = ret
    return ret
 end
 
@@ -65,6 +128,19 @@ local function make_entries_type(entry_type)
    return (ffi.typeof('$[?]', entry_type))
 end
 
+-- Vectorized search along displacement chains (see lib.linear_search),
+-- if enabled and the CPU supports it.  Searches read a few entries past
+-- the one they return, so entry vectors are allocated with that many
+-- spare entries at the end.
+local search_fns = {}
+local function make_search_fn(entry_type)
+   if not linear_search.available then return false end
+   if not search_fns[entry_type] then
+      search_fns[entry_type] = linear_search.gen(nil, entry_type)
+   end
+   return search_fns[entry_type]
+end
+
 -- hash := [0,HASH_MAX); scale := size/HASH_MAX
 local function hash_to_index(hash, scale)
    return (floor(hash*scale))
@@ -124,37 +200,62 @@ end
 local required_params = lib.set('key_type', 'value_type')
 local optional_params = {
    hash_seed = false,
+   hash_function = 'siphash',
    initial_size = 8,
    max_occupancy_rate = 0.9,
    min_occupancy_rate = 0.0,
-   resize_callback = false
+   resize_callback = false,
+   resize_step = false,
+   vectorized_search = false,
+   aging = false,
+   max_size = false,
+   eviction_samples = 5,
+   evict_callback = false
 }
 
-function new(params)
-   local ctab = {}   
-   local params = parse_params(params, required_params, optional_params)
-   ctab.entry_type = make_entry_type(params.key_type, params.value_type)
+local function construct(ctab, params, class)
+   ctab.entry_type = make_entry_type(params.key_type, params.value_type,
+                                     params.aging)
    ctab.type = make_entries_type(ctab.entry_type)
+   ctab.hash_function = params.hash_function
+   check_hash_function(ctab.hash_function)
    function ctab.make_hash_fn()
-      return compute_hash_fn(params.key_type, ctab.hash_seed)
+      return compute_hash_fn(params.key_type, ctab.hash_seed,
+                             ctab.hash_function)
    end
    function ctab.make_multi_hash_fn(width)
       local stride, seed = ffi.sizeof(ctab.entry_type), ctab.hash_seed
-      return compute_multi_hash_fn(params.key_type, width, stride, seed)
+      return compute_multi_hash_fn(params.key_type, width, stride, seed,
+                                   ctab.hash_function)
    end
    ctab.equal_fn = make_equal_fn(params.key_type)
+   ctab.search_fn = params.vectorized_search
+      and make_search_fn(ctab.entry_type)
+   ctab.search_padding = ctab.search_fn and linear_search.width or 0
    ctab.size = 0
    ctab.max_displacement = 0
    ctab.occupancy = 0
    ctab.max_occupancy_rate = params.max_occupancy_rate
    ctab.min_occupancy_rate = params.min_occupancy_rate
    ctab.resize_callback = params.resize_callback
-   ctab = setmetatable(ctab, { __index = CTable })
+   ctab.resize_step = params.resize_step
+   ctab.aging = params.aging
+   ctab.max_size = params.max_size
+   ctab.eviction_samples = params.eviction_samples
+   ctab.evict_callback = params.evict_callback
+   ctab.now = 0
+   ctab.expiry_cursor = 0
+   ctab = setmetatable(ctab, { __index = class })
    ctab:reseed_hash_function(params.hash_seed)
    ctab:resize(params.initial_size)
    return ctab
 end
 
+function new(params)
+   local params = parse_params(params, required_params, optional_params)
+   return construct({}, params, CTable)
+end
+
 -- FIXME: There should be a library to help allocate anonymous
 -- hugepages, not this code.
 local try_huge_pages = true
@@ -182,6 +283,10 @@ local function calloc(t, count)
    return ret, byte_size
 end
 
+function CTable:alloc_entries(count)
+   return calloc(self.entry_type, count)
+end
+
 function CTable:reseed_hash_function(seed)
    -- The hash function's seed determines the hash value of an input,
    -- and thus the iteration order for the table.  Usually this is a
@@ -209,7 +314,15 @@ function CTable:reseed_hash_function(seed)
    -- multi_hash functions.
 end
 
+local function set_size(self, size)
+   self.size = size
+   self.scale = self.size / HASH_MAX
+   self.occupancy_hi = ceil(self.size * self.max_occupancy_rate)
+   self.occupancy_lo = floor(self.size * self.min_occupancy_rate)
+end
+
 function CTable:resize(size)
+   self:migrate() -- Finish any incremental resize in progress.
    assert(size >= (self.occupancy / self.max_occupancy_rate))
    assert(size == floor(size))
    local old_entries = self.entries
@@ -218,20 +331,20 @@ function CTable:resize(size)
 
    -- Allocate double the requested number of entries to make sure there
    -- is sufficient displacement if all hashes map to the last bucket.
-   self.entries, self.byte_size = calloc(self.entry_type, size * 2)
-   self.size = size
-   self.scale = self.size / HASH_MAX
+   self.entries, self.byte_size =
+      self:alloc_entries(size * 2 + self.search_padding)
+   self.snapshot = nil
+   set_size(self, size)
    self.occupancy = 0
    self.max_displacement = 0
-   self.occupancy_hi = ceil(self.size * self.max_occupancy_rate)
-   self.occupancy_lo = floor(self.size * self.min_occupancy_rate)
    for i=0,self.size*2-1 do self.entries[i].hash = HASH_MAX end
 
    if old_size ~= 0 then self:reseed_hash_function() end
 
    for i=0,old_size+old_max_displacement-1 do
       if old_entries[i].hash ~= HASH_MAX then
-         self:add(old_entries[i].key, old_entries[i].value)
+         local entry = self:add(old_entries[i].key, old_entries[i].value)
+         if self.aging then entry.timestamp = old_entries[i].timestamp end
       end
    end
    if self.resize_callback then
@@ -239,7 +352,131 @@ function CTable:resize(size)
    end
 end
 
+-- Incremental resizing.  When the resize_step parameter is set, a table
+-- that crosses its occupancy limits is not rehashed in one go: a new
+-- table is allocated, and the old one is kept as self.migration until
+-- each add, lookup and removal has moved over the entries of another
+-- resize_step buckets of it.  Both tables use the same hash function
+-- and keep their entries in hash order, so entries whose hash maps below
+-- the migration cursor (old.bucket) live in the new table and all others
+-- in the old one, and each operation only has to probe one of them.
+-- Migrated entries are left in place in the old table; nothing probes
+-- them any more.  Entries of the new table are marked empty just ahead
+-- of those that can be in use, so that allocating it is cheap too.
+
+-- Mark empty the entries of the new table that entries hashing below
+-- the given bucket of the old table can reach.
+local function prepare_entries(self, old, bucket)
+   local limit = min(ceil(bucket * old.ratio) + self.max_displacement + 2,
+                     self.size * 2)
+   if old.init < limit then
+      local entries = self.entries
+      for i = old.init, limit - 1 do entries[i].hash = HASH_MAX end
+      old.init = limit
+   end
+end
+
+local function begin_resize(self, size)
+   assert(size >= (self.occupancy / self.max_occupancy_rate))
+   assert(size == floor(size))
+   local old = {
+      entries = self.entries,
+      byte_size = self.byte_size,
+      size = self.size,
+      scale = self.scale,
+      max_displacement = self.max_displacement,
+      bucket = 0, -- Old buckets below this have been migrated.
+      index = 0,  -- Old entries below this have been migrated.
+      init = 0,   -- New entries below this are initialized.
+      ratio = size * 2 / self.size
+   }
+   self.entries, self.byte_size =
+      self:alloc_entries(size * 2 + self.search_padding)
+   self.snapshot = nil
+   set_size(self, size)
+   self.max_displacement = 0
+   self.migration = old
+   prepare_entries(self, old, 0)
+   -- Move at least resize_step buckets per operation, but enough that
+   -- the migration is done before adds or removals can cross the new
+   -- occupancy limits, so that the next resize never has to finish
+   -- this one in one go.
+   local adds = self.occupancy_hi - self.occupancy
+   local removes = adds
+   if self.occupancy_lo > 0 then
+      removes = self.occupancy - self.occupancy_lo + 1
+   end
+   old.step = max(self.resize_step,
+                  ceil(old.size / max(min(adds, removes), 1)))
+end
+
+-- Move the entries of up to n buckets of the old table to the new one.
+local function migrate_buckets(self, n)
+   local old = self.migration
+   local entries, scale = old.entries, old.scale
+   local new_entries, new_scale = self.entries, self.scale
+   local bucket, index = old.bucket, old.index
+   local last = min(bucket + n, old.size)
+   while bucket < last do
+      index = max(index, bucket)
+      prepare_entries(self, old, bucket + 1)
+      while entries[index].hash ~= HASH_MAX
+         and hash_to_index(entries[index].hash, scale) == bucket do
+         -- This entry's hash is greater than that of any entry in the
+         -- new table, so it goes to the first free entry at or after
+         -- its start index.
+         local start = hash_to_index(entries[index].hash, new_scale)
+         local dest = start
+         while new_entries[dest].hash ~= HASH_MAX do dest = dest + 1 end
+         new_entries[dest] = entries[index]
+         self.max_displacement = max(self.max_displacement, dest - start)
+         prepare_entries(self, old, bucket + 1)
+         index = index + 1
+      end
+      bucket = bucket + 1
+   end
+   old.bucket, old.index = bucket, index
+   if bucket == old.size then
+      self.migration = nil
+      if self.resize_callback then
+         self.resize_callback(self, old.size)
+      end
+   end
+end
+
+-- Return the table (self, or the old table of the resize in progress)
+-- that holds entries with the given hash, after migrating another step.
+local function locate(self, hash)
+   local old = self.migration
+   migrate_buckets(self, old.step)
+   if hash_to_index(hash, old.scale) < old.bucket then
+      prepare_entries(self, old, old.bucket)
+      return self
+   end
+   return old
+end
+
+-- Resize due to the occupancy limits.
+local function auto_resize(self, size)
+   if self.resize_step and self.size > 0 then
+      self:migrate() -- Normally a no-op, see begin_resize.
+      begin_resize(self, size)
+   else
+      self:resize(size)
+   end
+end
+
+function CTable:migrate(buckets)
+   if self.migration then
+      migrate_buckets(self, buckets or self.migration.size)
+   end
+   return self.migration ~= nil
+end
+
 function CTable:get_backing_size()
+   if self.migration then
+      return self.byte_size + self.migration.byte_size
+   end
    return self.byte_size
 end
 
@@ -249,11 +486,22 @@ struct {
    uint32_t occupancy;
    uint32_t max_displacement;
    uint8_t hash_seed[16];
+   uint32_t hash_function;
    double max_occupancy_rate;
    double min_occupancy_rate;
 }
 ]]
 
+-- Saved tables are snapshots that can be used in place: their entries
+-- start on a page boundary, if the stream can align, and are followed
+-- by empty entries for lookups that read past the last one.  load()
+-- uses them without copying if the stream can map them (see
+-- lib.yang.stream), so loading takes time in the order of the page
+-- faults taken by lookups rather than of the size of the table.  The
+-- table is copied into private memory on its first modification.
+local snapshot_alignment = 4096
+local snapshot_padding = linear_search.width
+
 function load(stream, params)
    local header = stream:read_ptr(header_t)
    local params_copy = {}
@@ -262,46 +510,145 @@ function load(stream, params)
    params_copy.min_occupancy_rate = header.min_occupancy_rate
    params_copy.hash_seed = ffi.new('uint8_t[16]')
    ffi.copy(params_copy.hash_seed, header.hash_seed, 16)
+   params_copy.hash_function = hash_function_name(header.hash_function)
    params_copy.max_occupancy_rate = header.max_occupancy_rate
+   local mapped = stream.map_array ~= nil
+   -- Mapped tables allocate nothing up front.
+   if mapped then params_copy.initial_size = 0 end
    local ctab = new(params_copy)
+   local entry_count = header.size + header.max_displacement
+   if stream.align then stream:align(snapshot_alignment) end
+
+   if mapped then
+      set_size(ctab, header.size)
+      ctab.entries = stream:map_array(ctab.entry_type,
+                                      entry_count + snapshot_padding)
+      -- Report the size the table will have once copied.
+      ctab.byte_size = ffi.sizeof(ctab.entry_type)
+         * (ctab.size * 2 + ctab.search_padding)
+      ctab.snapshot = true
+   else
+      -- Slurp the entries directly into the ctable's backing store.
+      -- This ensures that the ctable is in hugepages.
+      C.memcpy(ctab.entries,
+               stream:read_array(ctab.entry_type,
+                                 entry_count + snapshot_padding),
+               ffi.sizeof(ctab.entry_type) * entry_count)
+   end
    ctab.occupancy = header.occupancy
    ctab.max_displacement = header.max_displacement
-   local entry_count = ctab.size + ctab.max_displacement
-
-   -- Slurp the entries directly into the ctable's backing store.
-   -- This ensures that the ctable is in hugepages.
-   C.memcpy(ctab.entries,
-            stream:read_array(ctab.entry_type, entry_count),
-            ffi.sizeof(ctab.entry_type) * entry_count)
 
    return ctab
 end
 
+-- Copy the entries of a table loaded from a snapshot into private
+-- memory, so that it can be modified.
+local function unshare_snapshot(self)
+   local snapshot, count = self.entries, self.size + self.max_displacement
+   self.entries, self.byte_size =
+      self:alloc_entries(self.size * 2 + self.search_padding)
+   self.snapshot = nil
+   C.memcpy(self.entries, snapshot, ffi.sizeof(self.entry_type) * count)
+   for i = count, self.size * 2 - 1 do self.entries[i].hash = HASH_MAX end
+end
+
 function CTable:save(stream)
+   self:migrate()
    stream:write_ptr(header_t(self.size, self.occupancy, self.max_displacement,
-                             self.hash_seed, self.max_occupancy_rate,
+                             self.hash_seed,
+                             hash_function_id(self.hash_function),
+                             self.max_occupancy_rate,
                              self.min_occupancy_rate),
                     header_t)
+   if stream.align then stream:align(snapshot_alignment) end
    stream:write_array(self.entries,
                       self.entry_type,
                       self.size + self.max_displacement)
+   local padding = self.type(snapshot_padding)
+   for i = 0, snapshot_padding - 1 do padding[i].hash = HASH_MAX end
+   stream:write_array(padding, self.entry_type, snapshot_padding)
+end
+
+-- Aging.  When the aging parameter is set, entries carry a timestamp:
+-- the table time, in milliseconds modulo 2^32, at which they were last
+-- added, updated or looked up with lookup_ptr.  The table time is set by
+-- the user, typically once per breath, which keeps clock reads off the
+-- per-lookup path.
+
+local TIME_WRAP = 2^32
+
+-- Age of an entry in milliseconds, valid for ages under 2^32 ms (about
+-- 49 days).
+local function entry_age(self, entry)
+   return (self.now - entry.timestamp) % TIME_WRAP
+end
+
+function CTable:set_time(now)
+   self.now = floor(now * 1000) % TIME_WRAP
+end
+
+function CTable:touch(entry)
+   entry.timestamp = self.now
+end
+
+-- Evict an entry to make room in a table that has reached its max_size:
+-- the least recently touched of eviction_samples entries picked at
+-- random if aging, and otherwise just a random entry.  This is only
+-- called when the table is full, so there is no risk of an infinite
+-- loop.
+local function evict(self)
+   self:migrate()
+   local entries = self.entries
+   local limit = self.size + self.max_displacement
+   local victim
+   for i = 1, self.aging and self.eviction_samples or 1 do
+      local index = floor(math.random() * self.size)
+      while entries[index].hash == HASH_MAX do
+         index = index + 1
+         if index >= limit then index = 0 end
+      end
+      if not victim
+         or (self.aging and entry_age(self, entries + index)
+                            > entry_age(self, victim)) then
+         victim = entries + index
+      end
+   end
+   if self.evict_callback then self.evict_callback(self, victim) end
+   self:remove_ptr(victim)
+end
+
+-- Make room for adding key to a table that has to stay within max_size.
+local function make_room(self, key, updates_allowed)
+   if self.size < self.max_size then
+      auto_resize(self, self.max_size)
+   elseif not (updates_allowed == 'required'
+               or (updates_allowed and self:lookup_ptr(key))) then
+      evict(self)
+   end
 end
 
 function CTable:add(key, value, updates_allowed)
+   if self.snapshot then unshare_snapshot(self) end
    if self.occupancy + 1 > self.occupancy_hi then
       -- Note that resizing will invalidate all hash keys, so we need
       -- to hash the key after resizing.
-      self:resize(max(self.size * 2, 1)) -- Could be current size is 0.
+      if self.max_size and self.size * 2 > self.max_size then
+         make_room(self, key, updates_allowed)
+      else
+         auto_resize(self, max(self.size * 2, 1)) -- Could be current size is 0.
+      end
    end
 
    local hash = self.hash_fn(key)
    assert(hash >= 0)
    assert(hash < HASH_MAX)
 
-   local entries = self.entries
-   local scale = self.scale
+   local t = self
+   if self.migration then t = locate(self, hash) end
+   local entries = t.entries
+   local scale = t.scale
    -- local start_index = hash_to_index(hash, self.scale)
-   local start_index = floor(hash*self.scale)
+   local start_index = floor(hash*scale)
    local index = start_index
 
    -- Fast path.
@@ -311,6 +658,7 @@ function CTable:add(key, value, updates_allowed)
       entry.hash = hash
       entry.key = key
       entry.value = value
+      if self.aging then entry.timestamp = self.now end
       return entry
    end
 
@@ -324,6 +672,7 @@ function CTable:add(key, value, updates_allowed)
          assert(updates_allowed, "key is already present in ctable")
          entry.key = key
          entry.value = value
+         if self.aging then entry.timestamp = self.now end
          return entry
       end
       index = index + 1
@@ -331,7 +680,7 @@ function CTable:add(key, value, updates_allowed)
 
    assert(updates_allowed ~= 'required', "key not found in ctable")
 
-   self.max_displacement = max(self.max_displacement, index - start_index)
+   t.max_displacement = max(t.max_displacement, index - start_index)
 
    if entries[index].hash ~= HASH_MAX then
       -- In a robin hood hash, we seek to spread the wealth around among
@@ -347,7 +696,7 @@ function CTable:add(key, value, updates_allowed)
       while empty > index do
          entries[empty] = entries[empty - 1]
          local displacement = empty - hash_to_index(entries[empty].hash, scale)
-         self.max_displacement = max(self.max_displacement, displacement)
+         t.max_displacement = max(t.max_displacement, displacement)
          empty = empty - 1;
       end
    end
@@ -357,6 +706,7 @@ function CTable:add(key, value, updates_allowed)
    entry.hash = hash
    entry.key = key
    entry.value = value
+   if self.aging then entry.timestamp = self.now end
    return entry
 end
 
@@ -366,17 +716,30 @@ end
 
 function CTable:lookup_ptr(key)
    local hash = self.hash_fn(key)
-   local entry = self.entries + hash_to_index(hash, self.scale)
+   local t = self
+   if self.migration then t = locate(self, hash) end
+   local entry = t.entries + hash_to_index(hash, t.scale)
 
    -- Fast path in case we find it directly.
    if hash == entry.hash and self.equal_fn(key, entry.key) then
+      if self.aging then entry.timestamp = self.now end
       return entry
    end
 
-   while entry.hash < hash do entry = entry + 1 end
+   if entry.hash < hash then
+      local search_fn = self.search_fn
+      if search_fn then
+         entry = search_fn(entry, hash)
+      else
+         while entry.hash < hash do entry = entry + 1 end
+      end
+   end
 
    while entry.hash == hash do
-      if self.equal_fn(key, entry.key) then return entry end
+      if self.equal_fn(key, entry.key) then
+         if self.aging then entry.timestamp = self.now end
+         return entry
+      end
       -- Otherwise possibly a collision.
       entry = entry + 1
    end
@@ -393,10 +756,20 @@ function CTable:lookup_and_copy(key, entry)
 end
 
 function CTable:remove_ptr(entry)
-   local scale = self.scale
-   local index = entry - self.entries
+   if self.snapshot then
+      local index = entry - self.entries
+      unshare_snapshot(self)
+      entry = self.entries + index
+   end
+   local t = self
+   local old = self.migration
+   if old and entry >= old.entries and entry < old.entries + old.size * 2 then
+      t = old
+   end
+   local scale = t.scale
+   local index = entry - t.entries
    assert(index >= 0)
-   assert(index < self.size + self.max_displacement)
+   assert(index < t.size + t.max_displacement)
    assert(entry.hash ~= HASH_MAX)
 
    self.occupancy = self.occupancy - 1
@@ -413,7 +786,7 @@ function CTable:remove_ptr(entry)
    end
 
    if self.occupancy < self.occupancy_lo then
-      self:resize(max(ceil(self.size / 2), 1))
+      auto_resize(self, max(ceil(self.size / 2), 1))
    end
 end
 
@@ -429,7 +802,9 @@ function CTable:remove(key, missing_allowed)
 end
 
 function CTable:make_lookup_streamer(width)
+   self:migrate()
    local res = {
+      ctab = self,
       all_entries = self.entries,
       width = width,
       equal_fn = self.equal_fn,
@@ -438,28 +813,34 @@ function CTable:make_lookup_streamer(width)
       pointers = ffi.new('void*['..width..']'),
       entries = self.type(width),
       hashes = ffi.new('uint32_t[?]', width),
-      -- Binary search over N elements can return N if no entry was
-      -- found that was greater than or equal to the key.  We would
-      -- have to check the result of binary search to ensure that we
-      -- are reading a value in bounds.  To avoid this, allocate one
-      -- more entry.
-      stream_entries = self.type(width * (self.max_displacement + 1) + 1)
+      -- Searching N elements can return N if no entry was found that
+      -- was greater than or equal to the key.  We would have to check
+      -- the result of the search to ensure that we are reading a value
+      -- in bounds.  To avoid this, allocate one more entry (or those
+      -- that a vectorized search reads ahead).
+      stream_entries = self.type(width * (self.max_displacement + 1)
+                                    + max(self.search_padding, 1))
    }
    -- Give res.pointers sensible default values in case the first lookup
    -- doesn't fill the pointers vector.
    for i = 0, width-1 do res.pointers[i] = self.entries end
 
    -- Initialize the stream_entries to HASH_MAX for sanity.
-   for i = 0, width * (self.max_displacement + 1) do
+   local padding = max(self.search_padding, 1)
+   for i = 0, width * (self.max_displacement + 1) + padding - 1 do
       res.stream_entries[i].hash = HASH_MAX
    end
 
-   -- Compile multi-copy and binary-search procedures that are
-   -- specialized for this table and this width.
+   -- Compile multi-copy and search procedures that are specialized for
+   -- this table and this width.
    local entry_size = ffi.sizeof(self.entry_type)
    res.multi_copy = multi_copy.gen(width, res.entries_per_lookup * entry_size)
    res.multi_hash = self.make_multi_hash_fn(width)
-   res.binary_search = binary_search.gen(res.entries_per_lookup, self.entry_type)
+   if self.search_fn then
+      res.search = linear_search.gen(res.entries_per_lookup, self.entry_type)
+   else
+      res.search = binary_search.gen(res.entries_per_lookup, self.entry_type)
+   end
 
    return setmetatable(res, { __index = LookupStreamer })
 end
@@ -472,6 +853,21 @@ function LookupStreamer:stream()
    local entries_per_lookup = self.entries_per_lookup
    local equal_fn = self.equal_fn
 
+   if self.ctab.migration then
+      -- The table is being resized incrementally: look up keys one by
+      -- one until it is done.
+      for i=0,width-1 do
+         local found = self.ctab:lookup_ptr(entries[i].key)
+         if found then
+            entries[i].hash = found.hash
+            entries[i].value = found.value
+         else
+            entries[i].hash = HASH_MAX
+         end
+      end
+      return
+   end
+
    local key_offset = 4 -- Skip past uint32_t hash.
    self.multi_hash(ffi.cast('uint8_t*', entries) + key_offset, self.hashes)
 
@@ -487,7 +883,7 @@ function LookupStreamer:stream()
    for i=0,width-1 do
       local hash = entries[i].hash
       local index = i * entries_per_lookup
-      local found = self.binary_search(stream_entries + index, hash)
+      local found = self.search(stream_entries + index, hash)
       -- It could be that we read one beyond the ENTRIES_PER_LOOKUP
       -- entries allocated for this key; that's fine.  See note in
       -- make_lookup_streamer.
@@ -529,6 +925,7 @@ function LookupStreamer:is_found(i)
 end
 
 function CTable:selfcheck()
+   self:migrate()
    local occupancy = 0
    local max_displacement = 0
 
@@ -567,6 +964,7 @@ function CTable:selfcheck()
 end
 
 function CTable:dump()
+   self:migrate()
    local function dump_one(index)
       io.write(index..':')
       local entry = self.entries[index]
@@ -583,6 +981,7 @@ function CTable:dump()
 end
 
 function CTable:iterate()
+   self:migrate()
    local max_entry = self.entries + self.size + self.max_displacement
    local function next_entry(max_entry, entry)
       while true do
@@ -594,6 +993,8 @@ function CTable:iterate()
    return next_entry, max_entry, self.entries - 1
 end
 
+-- Note that while a table is being resized incrementally this only
+-- visits entries that have moved to the new table.
 function CTable:next_entry(offset, limit)
    if offset >= self.size + self.max_displacement then
       return 0, nil
@@ -610,6 +1011,329 @@ function CTable:next_entry(offset, limit)
    return limit, nil
 end
 
+-- Visit up to budget entry slots, resuming where the last call left
+-- off, and remove the entries that have not been touched for at least
+-- max_age seconds, unless callback(entry, age) returns true.
+function CTable:expire(max_age, budget, callback)
+   assert(self.aging, "expire needs a table with aging")
+   -- Spend the budget on an incremental resize in progress, and sweep
+   -- once it is done.
+   if self.migration then
+      self:migrate(budget)
+      return 0
+   end
+   local max_age_ms = max_age * 1000
+   local index, removed = self.expiry_cursor, 0
+   for _ = 1, budget do
+      if index >= self.size + self.max_displacement then index = 0 end
+      local entry = self.entries + index
+      local expired = false
+      if entry.hash ~= HASH_MAX then
+         local age = entry_age(self, entry)
+         expired = age >= max_age_ms
+            and not (callback and callback(entry, age / 1000))
+      end
+      if expired then
+         -- Removal moves the following entries back one slot, so stay
+         -- at this index.
+         self:remove_ptr(entry)
+         removed = removed + 1
+         -- The removal may have started shrinking the table.
+         if self.migration then break end
+      else
+         index = index + 1
+      end
+   end
+   self.expiry_cursor = index
+   return removed
+end
+
+-- Shared tables.  A table created with new_shared() keeps its entries
+-- in shared memory, where other processes can map them read-only with
+-- open_shared() instead of building copies of their own.  The entries
+-- live in one shm object per generation, NAME/entries.GENERATION; each
+-- resize fills a new generation and then publishes it in the header
+-- object NAME/ctable.  Readers move to the new generation on their next
+-- lookup and only then unmap the old one, so the writer can unlink it
+-- straight away.
+--
+-- Writes within a generation are guarded by a sequence lock: the
+-- writer makes the sequence number odd while it changes entries, and
+-- even again when done.  Readers copy out what they look up, and retry
+-- if the sequence number was odd or changed in the meantime.
+
+local shared_header_t = ffi.typeof[[
+struct {
+   uint32_t seq;
+   uint32_t generation;
+   uint32_t entry_size;
+   uint32_t entry_count;
+   uint32_t size;
+   uint32_t occupancy;
+   uint32_t max_displacement;
+   uint32_t search_padding;
+   uint32_t hash_function;
+   uint8_t hash_seed[16];
+}
+]]
+
+local function shared_entries_name(name, generation)
+   return name.."/entries."..generation
+end
+
+function new_shared(name, params)
+   local params = parse_params(params, required_params, optional_params)
+   -- Shrinking would rebuild the table in the middle of a removal, and
+   -- readers cannot follow an incremental resize.
+   assert(params.min_occupancy_rate == 0,
+          "shared ctables do not support min_occupancy_rate")
+   assert(not params.resize_step, "shared ctables do not support resize_step")
+   assert(not params.aging and not params.max_size,
+          "shared ctables do not support aging or max_size")
+   assert(params.initial_size > 0, "shared ctables must not be empty")
+   local ctab = {
+      shm_name = name,
+      header = shm.create(name.."/ctable", shared_header_t),
+      generation = 0,
+      write_depth = 0
+   }
+   return construct(ctab, params, SharedCTable)
+end
+
+local function begin_write(self)
+   if self.rebuilding then return end
+   if self.write_depth == 0 then
+      self.header.seq = self.header.seq + 1
+      lib.compiler_barrier()
+   end
+   self.write_depth = self.write_depth + 1
+end
+
+local function end_write(self)
+   if self.rebuilding then return end
+   self.write_depth = self.write_depth - 1
+   if self.write_depth == 0 then
+      local header = self.header
+      header.occupancy = self.occupancy
+      header.max_displacement = self.max_displacement
+      lib.compiler_barrier()
+      header.seq = header.seq + 1
+   end
+end
+
+function SharedCTable:alloc_entries(count)
+   local generation = self.generation + 1
+   local entries_t = ffi.typeof('$[$]', self.entry_type, count)
+   local entries = shm.create(shared_entries_name(self.shm_name, generation),
+                              entries_t)
+   self.generation = generation
+   return ffi.cast(ffi.typeof('$*', self.entry_type), entries),
+          ffi.sizeof(entries_t)
+end
+
+function SharedCTable:resize(size)
+   local old_entries, old_generation = self.entries, self.generation
+   -- The new generation is private until published, so filling it
+   -- needn't hold off readers.
+   self.rebuilding = true
+   CTable.resize(self, size)
+   self.rebuilding = false
+
+   begin_write(self)
+   local header = self.header
+   header.generation = self.generation
+   header.entry_size = ffi.sizeof(self.entry_type)
+   header.entry_count = self.size * 2 + self.search_padding
+   header.size = self.size
+   header.search_padding = self.search_padding
+   header.hash_function = hash_function_id(self.hash_function)
+   ffi.copy(header.hash_seed, self.hash_seed, 16)
+   end_write(self)
+
+   if old_entries then
+      shm.unmap(old_entries)
+      shm.unlink(shared_entries_name(self.shm_name, old_generation))
+   end
+end
+
+function SharedCTable:add(key, value, updates_allowed)
+   -- Grow before locking, as CTable.add would, so that readers are not
+   -- held off while the next generation is filled.
+   if self.occupancy + 1 > self.occupancy_hi then
+      self:resize(max(self.size * 2, 1))
+   end
+   begin_write(self)
+   local entry = CTable.add(self, key, value, updates_allowed)
+   end_write(self)
+   return entry
+end
+
+function SharedCTable:remove_ptr(entry)
+   begin_write(self)
+   CTable.remove_ptr(self, entry)
+   end_write(self)
+end
+
+-- Remove the shm objects of a shared table.  Readers that have it
+-- mapped can keep using the current generation.
+function SharedCTable:unlink()
+   shm.unmap(self.entries)
+   shm.unmap(self.header)
+   shm.unlink(self.shm_name)
+   self.entries, self.header = nil, nil
+end
+
+function open_shared(name, params)
+   local params = parse_params(params, required_params, {})
+   local reader = {
+      shm_name = name,
+      header = shm.open(name.."/ctable", shared_header_t, true),
+      generation = 0,
+      key_type = params.key_type,
+      entry_type = make_entry_type(params.key_type, params.value_type, false),
+      equal_fn = make_equal_fn(params.key_type),
+      hash_seed = ffi.new('uint8_t[16]')
+   }
+   reader.type = make_entries_type(reader.entry_type)
+   reader.entry_size = ffi.sizeof(reader.entry_type)
+   function reader.make_multi_hash_fn(width)
+      local stride, seed = ffi.sizeof(reader.entry_type), reader.hash_seed
+      return compute_multi_hash_fn(params.key_type, width, stride, seed,
+                                   reader.hash_function)
+   end
+   reader = setmetatable(reader, { __index = SharedCTableReader })
+   assert(reader.header.entry_size == reader.entry_size,
+          "shared ctable has a different entry type")
+   reader:remap()
+   return reader
+end
+
+-- Map the current generation of the table.
+function SharedCTableReader:remap()
+   local header = self.header
+   while true do
+      local seq = header.seq
+      lib.compiler_barrier()
+      local generation, count = header.generation, header.entry_count
+      local size, padding = header.size, header.search_padding
+      local max_displacement = header.max_displacement
+      local hash_function = header.hash_function
+      local hash_seed = ffi.new('uint8_t[16]')
+      ffi.copy(hash_seed, header.hash_seed, 16)
+      lib.compiler_barrier()
+      if band(seq, 1) == 0 and header.seq == seq then
+         -- The writer may already have moved on and unlinked this
+         -- generation, in which case try again.
+         local ok, entries = pcall(
+            shm.open, shared_entries_name(self.shm_name, generation),
+            ffi.typeof('$[$]', self.entry_type, count), true)
+         if ok then
+            if self.entries then shm.unmap(self.entries) end
+            self.entries = ffi.cast(ffi.typeof('$*', self.entry_type), entries)
+            self.generation = generation
+            self.size = size
+            self.scale = size / HASH_MAX
+            self.max_displacement = max_displacement
+            self.search_padding = padding
+            self.search_fn = padding >= linear_search.width
+               and make_search_fn(self.entry_type)
+            ffi.copy(self.hash_seed, hash_seed, 16)
+            self.hash_function = hash_function_name(hash_function)
+            self.hash_fn = compute_hash_fn(self.key_type, self.hash_seed,
+                                           self.hash_function)
+            return
+         end
+      end
+   end
+end
+
+-- One attempt is inlined into callers' traces; retrying, and moving to a
+-- new generation, is left to the slow path.
+local function retry_lookup(self, key, entry)
+   if self.header.generation ~= self.generation then self:remap() end
+   return self:lookup_and_copy(key, entry)
+end
+
+function SharedCTableReader:lookup_and_copy(key, entry)
+   local header = self.header
+   local seq = header.seq
+   lib.compiler_barrier()
+   if band(seq, 1) == 0 and header.generation == self.generation then
+      local found = CTable.lookup_ptr(self, key)
+      if found then ffi.copy(entry, found, self.entry_size) end
+      lib.compiler_barrier()
+      if header.seq == seq then return found ~= nil end
+   end
+   return retry_lookup(self, key, entry)
+end
+
+-- Readers never resize; this lets CTable.make_lookup_streamer apply.
+function SharedCTableReader:migrate()
+   return false
+end
+
+function SharedCTableReader:make_lookup_streamer(width)
+   local res = {
+      reader = self,
+      width = width,
+      entries = self.type(width),
+      size = width * self.entry_size
+   }
+   res = setmetatable(res, { __index = SharedLookupStreamer })
+   res:rebuild()
+   return res
+end
+
+-- Build the underlying LookupStreamer for the current generation.
+function SharedLookupStreamer:rebuild()
+   local reader = self.reader
+   reader.max_displacement = max(reader.max_displacement,
+                                 reader.header.max_displacement)
+   self.streamer = CTable.make_lookup_streamer(reader, self.width)
+   self.generation = reader.generation
+   self.max_displacement = reader.max_displacement
+end
+
+-- Like LookupStreamer:stream(), but on a copy of the entries so that it
+-- can be retried.  The underlying streamer is rebuilt when the table
+-- moves to a new generation or entries get displaced further than it
+-- copies.
+local function retry_stream(self)
+   local reader = self.reader
+   if reader.header.generation ~= reader.generation then reader:remap() end
+   if reader.generation ~= self.generation
+      or reader.header.max_displacement > self.max_displacement then
+      self:rebuild()
+   end
+   return self:stream()
+end
+
+function SharedLookupStreamer:stream()
+   local header, streamer = self.reader.header, self.streamer
+   local seq = header.seq
+   lib.compiler_barrier()
+   if band(seq, 1) == 0 and header.generation == self.generation
+      and header.max_displacement <= self.max_displacement then
+      ffi.copy(streamer.entries, self.entries, self.size)
+      streamer:stream()
+      lib.compiler_barrier()
+      if header.seq == seq then
+         ffi.copy(self.entries, streamer.entries, self.size)
+         return
+      end
+   end
+   return retry_stream(self)
+end
+
+function SharedLookupStreamer:is_empty(i)
+   assert(i >= 0 and i < self.width)
+   return self.entries[i].hash == HASH_MAX
+end
+
+function SharedLookupStreamer:is_found(i)
+   return not self:is_empty(i)
+end
+
 function selftest()
    print("selftest: ctable")
    local bnot = require("bit").bnot
@@ -739,11 +1463,15 @@ function selftest()
 
    local function check_bytes_equal(type, a, b)
       local equal_fn = make_equal_fn(type)
-      local hash_fn = compute_hash_fn(type)
       assert(equal_fn(ffi.new(type, a), ffi.new(type, a)))
       assert(not equal_fn(ffi.new(type, a), ffi.new(type, b)))
-      assert(hash_fn(ffi.new(type, a)) == hash_fn(ffi.new(type, a)))
-      assert(hash_fn(ffi.new(type, a)) ~= hash_fn(ffi.new(type, b)))
+      for name, hash in pairs(hash_functions) do
+         if hash.available then
+            local hash_fn = compute_hash_fn(type, nil, name)
+            assert(hash_fn(ffi.new(type, a)) == hash_fn(ffi.new(type, a)))
+            assert(hash_fn(ffi.new(type, a)) ~= hash_fn(ffi.new(type, b)))
+         end
+      end
    end
    check_bytes_equal(ffi.typeof('uint16_t[1]'), {1}, {2})         -- 2 byte
    check_bytes_equal(ffi.typeof('uint32_t[1]'), {1}, {2})         -- 4 byte
@@ -751,5 +1479,392 @@ function selftest()
    check_bytes_equal(ffi.typeof('uint32_t[2]'), {1,1}, {1,2})     -- 8 byte
    check_bytes_equal(ffi.typeof('uint32_t[3]'), {1,1,1}, {1,1,2}) -- 12 byte
 
+   -- Incremental resizing: grow and shrink a table, checking lookups
+   -- against a Lua table, and streaming lookups while resizes are in
+   -- progress.
+   local resizes, migrating = 0, 0
+   local ctab = new({
+      key_type = ffi.typeof('uint32_t[1]'),
+      value_type = ffi.typeof('int32_t[6]'),
+      min_occupancy_rate = 0.1,
+      resize_step = 3,
+      resize_callback = function () resizes = resizes + 1 end
+   })
+   -- Resizes never have to finish the previous one in one go.
+   local migrate = ctab.migrate
+   function ctab:migrate(buckets)
+      assert(buckets or not self.migration, "bulk migration")
+      return migrate(self, buckets)
+   end
+   local streamer = ctab:make_lookup_streamer(4)
+   local present, count = {}, 0
+   local function check(i)
+      k[0] = i
+      local entry = ctab:lookup_ptr(k)
+      if present[i] then
+         assert(entry and entry.value[0] == present[i])
+      else
+         assert(entry == nil)
+      end
+   end
+   local function check_stream()
+      local keys = {}
+      for j = 0, 3 do
+         keys[j] = math.random(2e4)
+         streamer.entries[j].key[0] = keys[j]
+      end
+      streamer:stream()
+      for j = 0, 3 do
+         if present[keys[j]] then
+            assert(streamer:is_found(j))
+            assert(streamer.entries[j].value[0] == present[keys[j]])
+         else
+            assert(streamer:is_empty(j))
+         end
+      end
+   end
+   local function remove(i)
+      k[0] = i
+      assert(ctab:remove(k, true) == (present[i] ~= nil))
+      if present[i] then count = count - 1 end
+      present[i] = nil
+   end
+   for i = 1, 2e4 do
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+      present[i], count = bnot(i), count + 1
+      if ctab.migration then migrating = migrating + 1 end
+      check(math.random(i))
+      check(i + 1)
+      if i % 3 == 0 then
+         local j = math.random(i)
+         if present[j] then
+            k[0], v[0] = j, i
+            ctab:update(k, v)
+            present[j] = i
+         end
+      end
+      if i % 7 == 0 then remove(math.random(i)) end
+      if ctab.migration and i % 10 == 0 then check_stream() end
+   end
+   assert(ctab.occupancy == count)
+   local grown = resizes
+   for i = 1, 2e4 do
+      if i % 20 ~= 0 then remove(i) end
+      if ctab.migration then migrating = migrating + 1 end
+      check(math.random(2e4))
+      if ctab.migration and i % 10 == 0 then check_stream() end
+   end
+   assert(resizes > grown and migrating > 0)
+   ctab:selfcheck()
+   local iterated = 0
+   for entry in ctab:iterate() do
+      assert(present[entry.key[0]] == entry.value[0])
+      iterated = iterated + 1
+   end
+   assert(iterated == count and ctab.occupancy == count)
+
+   -- Vectorized search, on a full table with long displacement chains.
+   local ctab = new({
+      key_type = ffi.typeof('uint32_t[1]'),
+      value_type = ffi.typeof('int32_t[6]'),
+      max_occupancy_rate = 0.95,
+      vectorized_search = true
+   })
+   for i = 1, 1e5 do
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+   end
+   for i = 1, 2e5 do
+      k[0] = i
+      local entry = ctab:lookup_ptr(k)
+      if i <= 1e5 then
+         assert(entry and entry.value[0] == bnot(i))
+      else
+         assert(entry == nil)
+      end
+   end
+   local streamer = ctab:make_lookup_streamer(32)
+   for i = 1, 2e5, 32 do
+      for j = 0, 31 do streamer.entries[j].key[0] = i + j end
+      streamer:stream()
+      for j = 0, 31 do
+         if i + j <= 1e5 then
+            assert(streamer:is_found(j))
+            assert(streamer.entries[j].value[0] == bnot(i + j))
+         else
+            assert(streamer:is_empty(j))
+         end
+      end
+   end
+
+   -- Snapshots loaded from a file are used in place, and copied on
+   -- their first modification.
+   local stream = require("lib.yang.stream")
+   local params = { key_type = ffi.typeof('uint32_t[1]'),
+                    value_type = ffi.typeof('int32_t[1]'),
+                    vectorized_search = true }
+   local ctab = new(params)
+   local k, v = params.key_type(), params.value_type()
+   for i = 1, 1e4 do
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+   end
+   local tmp = os.tmpname()
+   local output = stream.open_output_byte_stream(tmp)
+   ctab:save(output)
+   output:close()
+   local function load_snapshot()
+      local input = stream.open_input_byte_stream(tmp)
+      local ctab = load(input, params)
+      input:close()
+      return ctab
+   end
+   local function check(ctab, removed, added)
+      for i = 1, 2e4 do
+         k[0] = i
+         local entry = ctab:lookup_ptr(k)
+         if i ~= removed and (i <= 1e4 or i == added) then
+            assert(entry and entry.value[0] == bnot(i))
+         else
+            assert(entry == nil)
+         end
+      end
+      local streamer = ctab:make_lookup_streamer(32)
+      for i = 1, 2e4, 32 do
+         for j = 0, 31 do streamer.entries[j].key[0] = i + j end
+         streamer:stream()
+         for j = 0, 31 do
+            local found = i + j ~= removed and (i + j <= 1e4 or i + j == added)
+            assert(streamer:is_found(j) == found)
+         end
+      end
+   end
+   local mapped = load_snapshot()
+   assert(mapped.snapshot and mapped.occupancy == 1e4)
+   assert(ffi.cast('uintptr_t', mapped.entries) % 4096 == 0)
+   assert(mapped:get_backing_size() == ctab:get_backing_size())
+   check(mapped)
+   k[0] = 1
+   mapped:remove(k)
+   assert(not mapped.snapshot)
+   check(mapped, 1)
+   k[0], v[0] = 1e4 + 1, bnot(1e4 + 1)
+   mapped:add(k, v)
+   check(mapped, 1, 1e4 + 1)
+   mapped:selfcheck()
+   check(load_snapshot())
+
+   -- Hash functions the CPU cannot run are rejected up front.
+   local crc32c_available = hash_functions.crc32c.available
+   hash_functions.crc32c.available = false
+   local ok, err = pcall(new, { key_type = params.key_type,
+                                value_type = params.value_type,
+                                hash_function = 'crc32c' })
+   hash_functions.crc32c.available = crc32c_available
+   assert(not ok and err:match('not supported by this CPU'))
+
+   -- Any hash function can be used, and saved tables record theirs.
+   for name, hash in pairs(hash_functions) do
+      if hash.available then
+         local ctab = new({ key_type = params.key_type,
+                            value_type = params.value_type,
+                            hash_function = name })
+         for i = 1, 1e4 do
+            k[0], v[0] = i, bnot(i)
+            ctab:add(k, v)
+         end
+         ctab:selfcheck()
+         check(ctab)
+         local output = stream.open_output_byte_stream(tmp)
+         ctab:save(output)
+         output:close()
+         local loaded = load_snapshot()
+         assert(loaded.hash_function == name)
+         check(loaded)
+      end
+   end
+   os.remove(tmp)
+
+   -- Bounded tables with aging evict entries that have not been touched
+   -- for a while.  Keys up to 100 are looked up again once the table is
+   -- full, so they and the keys added after them should mostly survive,
+   -- where random eviction would evict around 80 of them.
+   local key_t, value_t = ffi.typeof('uint32_t[1]'), ffi.typeof('int32_t[1]')
+   local evicted = {}
+   local ctab = new({
+      key_type = key_t, value_type = value_t, aging = true, max_size = 1000,
+      evict_callback = function (ctab, entry)
+         evicted[entry.key[0]] = true
+      end
+   })
+   local k, v = key_t(), value_t()
+   for i = 1, 900 do
+      ctab:set_time(i)
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+   end
+   for j = 1, 100 do k[0] = j; assert(ctab:lookup_ptr(k)) end
+   assert(ctab.size == 1000 and ctab.occupancy == 900 and not next(evicted))
+   k[0], v[0] = 1, 42
+   ctab:update(k, v)
+   ctab:add(k, v, true)
+   assert(ctab.occupancy == 900 and not next(evicted))
+   local count, young = 0, 0
+   for i = 901, 1200 do
+      ctab:set_time(i)
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+      assert(ctab:lookup_ptr(k))
+   end
+   for key in pairs(evicted) do
+      count = count + 1
+      if key <= 100 or key > 900 then young = young + 1 end
+   end
+   assert(ctab.size == 1000 and ctab.occupancy == 900 and count == 300)
+   assert(young <= 10)
+   ctab:selfcheck()
+
+   -- Without aging, bounded tables evict random entries.
+   local ctab = new({ key_type = key_t, value_type = value_t, max_size = 100 })
+   for i = 1, 1000 do
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+   end
+   assert(ctab.size == 100 and ctab.occupancy == 90)
+   ctab:selfcheck()
+
+   -- Incremental expiry.
+   local ctab = new({ key_type = key_t, value_type = value_t, aging = true })
+   for i = 1, 1000 do
+      ctab:set_time(i)
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+   end
+   ctab:set_time(1000)
+   local removed = 0
+   for i = 1, ctab.size * 2, 10 do removed = removed + ctab:expire(500, 10) end
+   assert(removed == 500 and ctab.occupancy == 500)
+   for i = 1, 1000 do
+      k[0] = i
+      assert((ctab:lookup_ptr(k) ~= nil) == (i > 500))
+   end
+   -- Looking keys up just now refreshed them; keep the even ones.
+   local function keep_even(entry, age)
+      assert(age == 0)
+      return entry.key[0] % 2 == 0
+   end
+   for i = 1, ctab.size * 2, 7 do ctab:expire(0, 7, keep_even) end
+   assert(ctab.occupancy == 250)
+   for entry in ctab:iterate() do assert(entry.key[0] % 2 == 0) end
+   ctab:selfcheck()
+   -- Expiry paces incremental resizes instead of finishing them.
+   local ctab = new({ key_type = key_t, value_type = value_t, aging = true,
+                      min_occupancy_rate = 0.1, resize_step = 3 })
+   local migrate = ctab.migrate
+   function ctab:migrate(buckets)
+      assert(buckets or not self.migration, "bulk migration")
+      return migrate(self, buckets)
+   end
+   for i = 1, 1000 do
+      ctab:set_time(i)
+      k[0], v[0] = i, bnot(i)
+      ctab:add(k, v)
+   end
+   ctab:set_time(2000)
+   local postponed = 0
+   for i = 1, 1e4 do
+      if ctab.migration then
+         postponed = postponed + 1
+         assert(ctab:expire(500, 10) == 0)
+      else
+         ctab:expire(500, 10)
+      end
+      if ctab.occupancy == 0 then break end
+   end
+   assert(ctab.occupancy == 0 and postponed > 0)
+   ctab.migrate = nil
+   ctab:selfcheck()
+
+   -- Shared tables, read by other processes while being written.  Keys
+   -- up to 1e4 stay present, with a version number and its complement
+   -- in their values, while others come and go and the table grows.
+   local name = "/"..S.getpid().."/ctable-selftest"
+   local key_t, value_t = ffi.typeof('uint32_t[1]'), ffi.typeof('int32_t[3]')
+   local ctab = new_shared(name, { key_type = key_t, value_type = value_t })
+   local k, v = key_t(), value_t()
+   for i = 1, 1e4 do
+      k[0], v[0], v[1], v[2] = i, bnot(i), 0, bnot(0)
+      ctab:add(k, v)
+   end
+   local function check_entry(key, found, value)
+      if key <= 1e4 then
+         assert(found and value[0] == bnot(key) and value[2] == bnot(value[1]))
+      elseif found then
+         assert(value[0] == bnot(key))
+      end
+   end
+   local function read_lookups()
+      local reader = open_shared(name, { key_type = key_t, value_type = value_t })
+      local k, entry = key_t(), reader.entry_type()
+      for i = 1, 5e5 do
+         k[0] = math.random(2e4)
+         check_entry(k[0], reader:lookup_and_copy(k, entry), entry.value)
+      end
+   end
+   local function read_streams()
+      local reader = open_shared(name, { key_type = key_t, value_type = value_t })
+      local streamer = reader:make_lookup_streamer(32)
+      for i = 1, 2e4 do
+         for j = 0, 31 do streamer.entries[j].key[0] = math.random(2e4) end
+         streamer:stream()
+         for j = 0, 31 do
+            check_entry(streamer.entries[j].key[0], streamer:is_found(j),
+                        streamer.entries[j].value)
+         end
+      end
+   end
+   local readers = {}
+   for _, read in ipairs({read_lookups, read_streams}) do
+      io.stdout:flush() -- Don't have the readers repeat buffered output.
+      local pid = S.fork()
+      if pid == 0 then
+         local ok, err = pcall(read)
+         if not ok then print(err) end
+         S.exit(ok and 0 or 1)
+      end
+      readers[pid] = true
+   end
+   local i, running = 0, 2
+   while running > 0 do
+      i = i + 1
+      k[0], v[0] = 1e4 + i, bnot(1e4 + i)
+      ctab:add(k, v)
+      if i % 2 == 0 then ctab:remove(k) end
+      k[0] = i % 1e4 + 1
+      v[0], v[1], v[2] = bnot(k[0]), i, bnot(i)
+      ctab:update(k, v)
+      if i % 1e4 == 0 then ctab:resize(ctab.size) end
+      if i % 100 == 0 then
+         for pid in pairs(readers) do
+            local ret, _, status = S.waitpid(pid, "nohang")
+            if ret == pid then
+               assert(status.EXITSTATUS == 0, "shared ctable reader failed")
+               readers[pid], running = nil, running - 1
+            end
+         end
+      end
+   end
+   ctab:selfcheck()
+   local reader = open_shared(name, { key_type = key_t, value_type = value_t })
+   local entry = reader.entry_type()
+   for i = 1, 1e4 + i do
+      k[0] = i
+      local found = ctab:lookup_ptr(k)
+      assert(reader:lookup_and_copy(k, entry) == (found ~= nil))
+      if found then assert(entry.value[1] == found.value[1]) end
+   end
+   ctab:unlink()
+
    print("selftest: ok")
 end
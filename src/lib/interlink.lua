@@ -16,9 +16,12 @@ module(...,package.seeall)
 --    Receiver                   Transmitter
 --    ----------                 -------------
 --    attach_receiver(name)      attach_transmitter(name)
---    empty(r)                   full(r)
+--    empty(r)                   full(r), nwritable(r)
 --    extract(r)                 insert(r, p)
 --    pull(r)                    push(r)
+--    enable_wakeup(r)           wakeup_enabled(r)
+--    open_wakeup(name)          open_wakeup(name)
+--    wait(r, fd), awake(r, fd)  wakeup(r, fd)
 --    detach_receiver(r, name)   detach_transmitter(r, name)
 --
 -- I.e., both receiver and transmitter will attach to a queue object they wish
@@ -49,6 +52,10 @@ module(...,package.seeall)
 --    full(r) / empty(r)
 --       Return true if the interlink r is full / empty.
 --
+--    nwritable(r)
+--       Returns the number of packets that can be inserted into interlink r
+--       before it becomes full.
+--
 --    insert(r, p) / extract(r)
 --       Insert a packet p into / extract a packet from interlink r. Must not
 --       be called if r is full / empty.
@@ -56,12 +63,37 @@ module(...,package.seeall)
 --    push(r) / pull(r)
 --       Makes subsequent calls to full / empty reflect updates to the queue
 --       caused by insert / extract.
+--
+--    enable_wakeup(r) / wakeup_enabled(r)
+--       The receiver calls enable_wakeup(r) once it wants to block on the
+--       wakeup FIFO. Until then wakeup_enabled(r) is false and the
+--       transmitter need not call wakeup, which costs a memory barrier.
+--       A push that races with enable_wakeup may not wake the receiver;
+--       the engine bounds the wait with engine.eventwait_timeout.
+--
+--    open_wakeup(name)
+--       Returns a file descriptor of a FIFO next to interlink name that
+--       lets a receiver block until packets arrive (e.g. in epoll.)
+--
+--    wait(r, fd)
+--       Announces that the receiver of r is about to block on the wakeup
+--       FIFO fd. From then on the next wakeup(r, fd) by the transmitter
+--       makes fd readable (it is made readable right away if r is not
+--       empty.)
+--
+--    awake(r, fd)
+--       Called by the receiver after wait(r, fd) once it no longer blocks.
+--
+--    wakeup(r, fd)
+--       Called by the transmitter after push(r) to make the wakeup FIFO fd
+--       readable if the receiver waits for packets.
 
 local shm = require("core.shm")
 local ffi = require("ffi")
 local band = require("bit").band
 local waitfor = require("core.lib").waitfor
 local sync = require("core.sync")
+local S = require("syscall")
 
 local SIZE = 1024
 local CACHELINE = 64 -- XXX - make dynamic
@@ -72,9 +104,12 @@ assert(band(SIZE, SIZE-1) == 0, "SIZE is not a power of two")
 -- Based on MCRingBuffer, see
 --   http://www.cse.cuhk.edu.hk/%7Epclee/www/pubs/ipdps10.pdf
 
+-- Version of the layout below, checked when both ends attach.
+local VERSION = 1
+
 ffi.cdef([[ struct interlink {
-   int read, write, state[1];
-   char pad1[]]..CACHELINE-3*INT..[[];
+   int read, write, state[1], waiting[1], notify[1], version[1];
+   char pad1[]]..CACHELINE-6*INT..[[];
    int lwrite, nread;
    char pad2[]]..CACHELINE-2*INT..[[];
    int lread, nwrite;
@@ -151,20 +186,39 @@ local function attach (name, initialize)
    return r
 end
 
+-- The end that attaches to a free queue records the layout version
+-- before it changes the state, and the end that joins it checks it
+-- before it changes the state, so that processes built with a different
+-- layout do not share a queue and the queue is left as it was. The end
+-- that attaches first does not check anything: a peer with a layout
+-- from before the version field was added does not know about it, and
+-- is not detected.
+local function join (r, up, other_up)
+   if r.state[0] == FREE then r.version[0] = VERSION end
+   if sync.cas(r.state, FREE, up) then return true end
+   if r.state[0] == other_up and r.version[0] ~= VERSION then
+      error("interlink: incompatible queue layout (version "
+               ..r.version[0]..", expected "..VERSION..")")
+   end
+   return sync.cas(r.state, other_up, DXUP)
+end
+
 function attach_receiver (name)
    return attach(name,
                  -- Attach to free queue as receiver (FREE -> RXUP)
                  -- or queue with ready transmitter (TXUP -> DXUP.)
-                 function (r) return sync.cas(r.state, FREE, RXUP)
-                                  or sync.cas(r.state, TXUP, DXUP) end)
+                 function (r)
+                    if not join(r, RXUP, TXUP) then return false end
+                    r.notify[0] = 0
+                    return true
+                 end)
 end
 
 function attach_transmitter (name)
    return attach(name,
                  -- Attach to free queue as transmitter (FREE -> TXUP)
                  -- or queue with ready receiver (RXUP -> DXUP.)
-                 function (r) return sync.cas(r.state, FREE, TXUP)
-                                  or sync.cas(r.state, RXUP, DXUP) end)
+                 function (r) return join(r, TXUP, RXUP) end)
 end
 
 local function detach (r, name, reset, shutdown)
@@ -181,6 +235,7 @@ local function detach (r, name, reset, shutdown)
                packet.free(extract(r))
             end
             shm.unlink(name)
+            shm.unlink(name..".wakeup")
             return true
          end
       end
@@ -189,6 +244,7 @@ local function detach (r, name, reset, shutdown)
 end
 
 function detach_receiver (r, name)
+   r.notify[0] = 0
    detach(r, name,
           -- Reset: detach from queue with active transmitter (DXUP -> TXUP.)
           function (r) return sync.cas(r.state, DXUP, TXUP) end,
@@ -220,6 +276,11 @@ function full (r)
    end
 end
 
+function nwritable (r)
+   r.lread = r.read
+   return band(r.lread - r.nwrite - 1, SIZE - 1)
+end
+
 function insert (r, p)
    r.packets[r.nwrite] = p
    r.nwrite = NEXT(r.nwrite)
@@ -250,6 +311,46 @@ function pull (r)
    r.read = r.nread
 end
 
+-- Blocking receivers. The receiver sets r.waiting before it blocks and
+-- then checks for packets, while the transmitter pushes packets and
+-- then checks r.waiting. The memory barriers ensure that at least one
+-- of them sees the update of the other, so no wakeup is lost.
+
+function open_wakeup (name)
+   local path = shm.root.."/"..shm.resolve(name..".wakeup")
+   S.mkfifo(path, "rusr, wusr")
+   -- Opening a FIFO for both reading and writing does not block.
+   return assert(S.open(path, "rdwr, nonblock"))
+end
+
+local wakeup_byte = ffi.new("char[1]")
+
+function enable_wakeup (r)
+   r.notify[0] = 1
+end
+
+function wakeup_enabled (r)
+   return r.notify[0] == 1
+end
+
+function wait (r, fd)
+   r.waiting[0] = 1
+   sync.mfence()
+   if not empty(r) then wakeup(r, fd) end
+end
+
+function awake (r, fd)
+   r.waiting[0] = 0
+   while S.read(fd, wakeup_byte, 1) == 1 do end
+end
+
+function wakeup (r, fd)
+   sync.mfence()
+   if r.waiting[0] == 1 and sync.cas(r.waiting, 1, 0) then
+      S.write(fd, wakeup_byte, 1)
+   end
+end
+
 -- The code below registers an abstract SHM object type with core.shm, and
 -- implements the minimum API necessary for programs like snabb top to inspect
 -- interlink queues (including a tostring meta-method to describe queue
@@ -10,6 +10,7 @@ module(...,package.seeall)
 
 local S = require("syscall")
 local pci = require("lib.hardware.pci")
+local packet = require("core.packet")
 
 local bound_cpu
 local bound_numa_node
@@ -122,14 +123,20 @@ function bind_to_numa_node (node)
    if not node then return unbind_numa_node() end
    assert(not bound_numa_node, "already bound")
 
+   local migrated = false
    if supports_numa() then
       assert(S.set_mempolicy('bind', node))
 
       -- Migrate any pages that might have the wrong affinity.
       local from_mask = assert(S.get_mempolicy(nil, nil, nil, 'mems_allowed')).mask
       assert(S.migrate_pages(0, from_mask, node))
+      migrated = true
    end
 
+   -- Allocate DMA memory and packets on node from now on, and keep
+   -- using the packets that were just migrated.
+   packet.set_numa_node(node, migrated)
+
    bound_numa_node = node
 end
 
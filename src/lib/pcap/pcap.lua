@@ -45,10 +45,14 @@ function write_record (file, ffi_buffer, length)
    file:flush()
 end
 
-function write_record_header (file, length)
+-- Optionally, orig_length is the length of the packet if it was
+-- truncated to length, and ts_sec and ts_usec its timestamp.
+function write_record_header (file, length, orig_length, ts_sec, ts_usec)
    local pcap_record = ffi.new(pcap_record_t)
+   pcap_record.ts_sec = ts_sec or 0
+   pcap_record.ts_usec = ts_usec or 0
    pcap_record.incl_len = length
-   pcap_record.orig_len = length
+   pcap_record.orig_len = orig_length or length
    file:write(ffi.string(pcap_record, ffi.sizeof(pcap_record)))
 end
 
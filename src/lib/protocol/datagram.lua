@@ -294,7 +294,7 @@ end
 -- non-nil, the memory region at the given address and size is
 -- appended to the packet's payload first.
 function datagram:payload (mem, size)
-   if mem then packet.append(self._packet[0], mem, size) end
+   if mem then self._packet[0] = packet.append(self._packet[0], mem, size) end
    return self._packet[0].data + self._parse.offset,
           self._packet[0].length - self._parse.offset
 end
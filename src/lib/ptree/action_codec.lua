@@ -32,9 +32,10 @@ function actions.free_link (codec, linkspec)
    local linkspec = codec:string(linkspec)
    return codec:finish(linkspec)
 end
-function actions.new_link (codec, linkspec)
+function actions.new_link (codec, linkspec, size)
    local linkspec = codec:string(linkspec)
-   return codec:finish(linkspec)
+   local size = codec:uint32(size)
+   return codec:finish(linkspec, size)
 end
 function actions.link_output (codec, appname, linkname, linkspec)
    local appname = codec:string(appname)
@@ -222,7 +223,7 @@ function selftest ()
    test_action({'unlink_output', {appname, linkname}})
    test_action({'unlink_input', {appname, linkname}})
    test_action({'free_link', {linkspec}})
-   test_action({'new_link', {linkspec}})
+   test_action({'new_link', {linkspec, 1024}})
    test_action({'link_output', {appname, linkname, linkspec}})
    test_action({'link_input', {appname, linkname, linkspec}})
    test_action({'stop_app', {appname}})
@@ -12,6 +12,8 @@ local packet    = require("core.packet")
 local timer     = require("core.timer")
 local VirtioVirtq = require("lib.virtio.virtq_device")
 local checksum  = require("lib.checksum")
+local sync      = require("core.sync")
+local S         = require("syscall")
 local ffi       = require("ffi")
 local C         = ffi.C
 local band      = bit.band
@@ -68,10 +70,12 @@ local max_virtq_pairs = 16
 
 VirtioNetDevice = {}
 
-function VirtioNetDevice:new(owner, disable_mrg_rxbuf, disable_indirect_desc)
+function VirtioNetDevice:new(owner, disable_mrg_rxbuf, disable_indirect_desc,
+                             chain_rx)
    assert(owner)
    local o = {
       owner = owner,
+      chain_rx = chain_rx,
       callfd = {},
       kickfd = {},
       virtq = {},
@@ -136,7 +140,10 @@ function VirtioNetDevice:receive_packets_from_vm ()
 end
 
 function VirtioNetDevice:rx_packet_start(addr, len)
-   local rx_p = packet.allocate()
+   -- Size the packet for the data in the first descriptor, which
+   -- usually holds the whole frame. It is promoted if more follows.
+   local rx_p = packet.allocate(math.max(len - self.hdr_size, 0))
+   self.rx_p = rx_p
 
    local rx_hdr = ffi.cast(virtio_net_hdr_type, self:map_from_guest(addr))
    self.rx_hdr_flags = rx_hdr.flags
@@ -151,14 +158,24 @@ function VirtioNetDevice:rx_buffer_add(rx_p, addr, len)
    local addr = self:map_from_guest(addr)
    local pointer = ffi.cast(char_ptr_t, addr)
 
-   packet.append(rx_p, pointer, len)
+   if self.chain_rx then
+      -- Frames larger than a packet become multi-segment packets.
+      packet.append_chained(rx_p, pointer, len)
+   else
+      -- The packet can move when it grows, so track the latest copy.
+      self.rx_p = packet.append(self.rx_p, pointer, len)
+   end
    return len
 end
 
-function VirtioNetDevice:rx_packet_end(header_id, total_size, rx_p)
+function VirtioNetDevice:rx_packet_end(header_id, total_size)
+   local rx_p = self.rx_p
+   self.rx_p = nil
    local l = self.owner.output.tx
    if l then
+      -- The checksum of multi-segment frames is left to the receiver.
       if band(self.rx_hdr_flags, C.VIO_NET_HDR_F_NEEDS_CSUM) ~= 0 and
+         rx_p.next == nil and
          -- Bounds-check the checksum area
          self.rx_hdr_csum_start  <= rx_p.length - 2 and
          self.rx_hdr_csum_offset <= rx_p.length - 2
@@ -232,7 +249,7 @@ function VirtioNetDevice:tx_packet_start(addr, len)
    local l = self.owner.input.rx
    assert(l, "input port not found")
    if link.empty(l) then return nil, nil end
-   local tx_p = link.receive(l)
+   local tx_p = packet.linearize(link.receive(l))
 
    local tx_hdr = ffi.cast(virtio_net_hdr_type, self:map_from_guest(addr))
 
@@ -274,7 +291,7 @@ function VirtioNetDevice:tx_packet_start_mrg_rxbuf(addr, len)
    -- for the first buffer receive a packet and save its header pointer
    if not tx_p then
       if link.empty(l) then return end
-      tx_p = link.receive(l)
+      tx_p = packet.linearize(link.receive(l))
 
       if band(self.features, C.VIRTIO_NET_F_CSUM) == 0 then
          tx_mrg_hdr.hdr.flags = 0
@@ -435,6 +452,44 @@ function VirtioNetDevice:set_vring_kick(idx, fd)
    self.virtq[idx].kickfd = fd
 end
 
+-- Blocking receive. Normally the guest is told not to kick the rings
+-- it transmits on (VRING_F_NO_NOTIFY) because we poll them. Before
+-- the engine blocks, rx_wait lets the guest kick them again and returns
+-- their kick eventfds, and rx_awake restores polling afterwards.
+
+local eventfd_value = ffi.new("uint64_t[1]", 1)
+
+function VirtioNetDevice:rx_wait()
+   local fds = {}
+   for i = 0, self.virtq_pairs-1 do
+      local virtq = self.virtq[2*i+1]
+      if virtq.virtq and virtq.kickfd then
+         virtq.virtq.used.flags = 0
+         sync.mfence()
+         -- Kick ourselves if the guest transmitted in the meantime.
+         if virtq.virtq.avail.idx ~= virtq.avail then
+            S.write(virtq.kickfd, eventfd_value, 8)
+         end
+         fds[#fds+1] = virtq.kickfd
+      end
+   end
+   self.rx_waiting = true
+   return fds
+end
+
+function VirtioNetDevice:rx_awake()
+   for i = 0, self.virtq_pairs-1 do
+      local virtq = self.virtq[2*i+1]
+      if virtq.virtq and virtq.kickfd then
+         virtq.virtq.used.flags = C.VRING_F_NO_NOTIFY
+         local t = S.select({readfds = {virtq.kickfd}}, 0)
+         if t and t.count == 1 then S.read(virtq.kickfd, eventfd_value, 8) end
+      end
+   end
+   eventfd_value[0] = 1
+   self.rx_waiting = false
+end
+
 function VirtioNetDevice:set_vring_addr(idx, ring)
 
    self.virtq[idx].virtq = ring
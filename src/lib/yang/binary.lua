@@ -14,7 +14,7 @@ local ctable = require('lib.ctable')
 local cltable = require('lib.cltable')
 
 local MAGIC = "yangconf"
-local VERSION = 0x00008000
+local VERSION = 0x00008001
 
 local header_t = ffi.typeof([[
 struct {
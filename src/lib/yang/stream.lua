@@ -106,8 +106,8 @@ function open_input_byte_stream(filename)
       mtime_nsec=stat.st_mtime_nsec
    }
    function ret:close()
-      -- FIXME: Currently we don't unmap any memory.
-      -- S.munmap(mem, size)
+      -- The file stays mapped: arrays returned by map_array() point
+      -- into it.
       mem, pos = nil, nil
    end
    function ret:error(msg)
@@ -140,6 +140,12 @@ function open_input_byte_stream(filename)
       return ffi.cast(ffi.typeof('$*', type),
                       ret:read(ffi.sizeof(type) * count))
    end
+   -- Like read_array, but the result remains valid after the stream is
+   -- closed.  The mapping is private, so writes to it copy the pages
+   -- they touch and do not affect the file.
+   function ret:map_array(type, count)
+      return ret:read_array(type, count)
+   end
    function ret:read_char()
       return ffi.string(ret:read(1), 1)
    end
@@ -0,0 +1,62 @@
+-- Use of this source code is governed by the Apache 2.0 license; see COPYING.
+
+module(..., package.seeall)
+
+local ffi = require("ffi")
+local C = ffi.C
+local S = require("syscall")
+local lib = require("core.lib")
+local shm = require("core.shm")
+local capture = require("lib.capture")
+local pcap = require("lib.pcap.pcap")
+local usage = require("program.capture.README_inc")
+
+local long_opts = {
+   help = "h", filter = "f", packets = "n", bytes = "b"
+}
+
+function run (args)
+   local conf = {}
+   local opt = {}
+   function opt.h (arg) print(usage) main.exit(1) end
+   function opt.f (arg) conf.filter = arg end
+   function opt.n (arg) conf.packets = assert(tonumber(arg), "bad count") end
+   function opt.b (arg) conf.bytes = assert(tonumber(arg), "bad count") end
+   args = lib.dogetopt(args, opt, "hf:n:b:", long_opts)
+   if #args ~= 3 then print(usage) main.exit(1) end
+   local pid, linkspec, filename = unpack(args)
+   if not shm.exists("/"..pid.."/engine/configs.counter") then
+      print("No Snabb instance with pid "..pid..".")
+      main.exit(1)
+   end
+   local file = assert(io.open(filename, "w"))
+   pcap.write_file_header(file)
+
+   -- Handle SIGINT and SIGTERM via fd so that we get to remove the
+   -- capture (which disarms the tap) before exiting.
+   local signals = S.signalfd("int,term", "nonblock")
+   S.sigprocmask("block", "int,term")
+
+   local cap, name = capture.request(pid, linkspec, conf)
+   local packets = 0
+   while true do
+      packets = packets + capture.drain(cap, file)
+      local done, err = capture.done(cap)
+      if err then
+         print("capture failed: "..err)
+         shm.unlink(name)
+         main.exit(1)
+      end
+      if done or #S.util.signalfd_read(signals) > 0
+         or not S.kill(tonumber(pid), 0) then
+         break
+      end
+      C.usleep(1000)
+   end
+   packets = packets + capture.drain(cap, file)
+   file:close()
+   print(("Captured %d packets (%d dropped)."):format(
+         packets, tonumber(cap.dropped)))
+   shm.unmap(cap)
+   shm.unlink(name)
+end
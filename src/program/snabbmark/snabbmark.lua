@@ -8,6 +8,7 @@ local basic_apps = require("apps.basic.basic_apps")
 local pci           = require("lib.hardware.pci")
 local ethernet      = require("lib.protocol.ethernet")
 local lib = require("core.lib")
+local counter = require("core.counter")
 local ffi = require("ffi")
 local C = ffi.C
 
@@ -27,6 +28,18 @@ function run (args)
       hash(unpack(args))
    elseif command == 'ctable' and #args == 0 then
       ctable(unpack(args))
+   elseif command == 'rangemap' and #args <= 1 then
+      rangemap(unpack(args))
+   elseif command == 'copy' and #args <= 1 then
+      copy(unpack(args))
+   elseif command == 'batch' and #args <= 1 then
+      link_batch(unpack(args))
+   elseif command == 'imix' and #args <= 1 then
+      imix(unpack(args))
+   elseif command == 'freelist' and #args <= 2 then
+      freelist(unpack(args))
+   elseif command == 'timers' and #args <= 1 then
+      timers(unpack(args))
    else
       print(usage) 
       main.exit(1)
@@ -434,12 +447,7 @@ local function test_perf(f, iterations, what)
    return res
 end
 
-function hash (key_size)
-   if key_size then
-      key_size = assert(tonumber(key_size))
-   else
-      key_size = 4
-   end
+local function hash_key_size (key_size)
    local value_t = ffi.typeof("uint8_t[$]", key_size)
    local band = require('bit').band
    local fill = require('ffi').fill
@@ -479,17 +487,17 @@ function hash (key_size)
       end
    end
 
-   local function sip_hash_tester(opts, width)
+   local function multi_hash_tester(module, opts, width)
       local opts = lib.deepcopy(opts)
       opts.size = key_size
       if width > 1 then
          opts.width = width
-         local hash = lib_siphash.make_multi_hash(opts)
+         local hash = module.make_multi_hash(opts)
 	 return function(iterations)
 	    return test_parallel_hash(iterations, hash, width)
 	 end
       else
-         return hash_tester(lib_siphash.make_hash(opts))
+         return hash_tester(module.make_hash(opts))
       end
    end
 
@@ -497,11 +505,31 @@ function hash (key_size)
    test_perf(hash_tester(murmur_hash), 1e8, 'murmur hash (32 bit)')
    for _, opts in ipairs({{c=1,d=2}, {c=2,d=4}}) do
       for _, width in ipairs({1,2,4,8}) do
-         test_perf(sip_hash_tester(opts, width), 1e8,
+         test_perf(multi_hash_tester(lib_siphash, opts, width), 1e8,
                    string.format('sip hash c=%d,d=%d (x%d)',
                                  opts.c, opts.d, width))
       end
    end
+   for _, name in ipairs({'crc32c', 'aes'}) do
+      local module = require('lib.hash.'..name)
+      if module.available then
+         for _, width in ipairs({1,2,4,8}) do
+            test_perf(multi_hash_tester(module, {}, width), 1e8,
+                      string.format('%s hash (x%d)', name, width))
+         end
+      else
+         print(name..' hash: not supported on this CPU')
+      end
+   end
+end
+
+function hash (key_size)
+   local key_sizes = {4, 8, 12, 16, 36}
+   if key_size then key_sizes = {assert(tonumber(key_size))} end
+   for _, key_size in ipairs(key_sizes) do
+      print(('%d-byte keys:'):format(key_size))
+      hash_key_size(key_size)
+   end
 end
 
 function ctable ()
@@ -570,4 +598,450 @@ function ctable ()
                 'streaming lookup, stride='..stride)
       stride = stride * 2
    until stride > 256
+
+   -- The same lookups by a reader of a shared table.
+   local types = { key_type = ffi.typeof('uint32_t[2]'),
+                   value_type = ffi.typeof('int32_t[5]') }
+   local shared = ctable.new_shared(
+      'snabbmark-ctable', { key_type = types.key_type,
+                            value_type = types.value_type,
+                            initial_size = occupancy / 0.4 + 1 })
+   test_perf(function (count)
+                local k = ffi.new('uint32_t[2]');
+                local v = ffi.new('int32_t[5]');
+                for i = 1, count do
+                   k[0], k[1] = i, i
+                   for j=0,4 do v[j] = bnot(i) end
+                   shared:add(k, v)
+                end
+             end, occupancy, 'shared insertion (40% occupancy)')
+   local reader = ctable.open_shared('snabbmark-ctable', types)
+   local function test_shared_lookup(count)
+      local k = ffi.new('uint32_t[2]');
+      local result = reader.entry_type()
+      for i = 1, count do
+         k[0], k[1] = i, i
+         reader:lookup_and_copy(k, result)
+      end
+      return result
+   end
+   local streamer = reader:make_lookup_streamer(32)
+   local function test_shared_streamer(count)
+      local result
+      for i = 1, count, 32 do
+         local n = math.min(32, count-i+1)
+         for j = 0, n-1 do
+            streamer.entries[j].key[0] = i + j
+            streamer.entries[j].key[1] = i + j
+         end
+         streamer:stream()
+         result = streamer.entries[n-1].value[0]
+      end
+      return result
+   end
+   test_perf(test_shared_lookup, occupancy,
+             'shared lookup_and_copy (40% occupancy)')
+   test_perf(test_shared_streamer, occupancy,
+             'shared streaming lookup, stride=32')
+   shared:unlink()
+
+   -- Worst-case latency of add and lookup_ptr while a table grows from
+   -- its default size, resizing in one go or incrementally.
+   local function test_resize_latency(resize_step)
+      local ctab = ctable.new(
+         { key_type = ffi.typeof('uint32_t[2]'),
+           value_type = ffi.typeof('int32_t[5]'),
+           resize_step = resize_step })
+      local k = ffi.new('uint32_t[2]');
+      local v = ffi.new('int32_t[5]');
+      local worst_add, worst_lookup = 0, 0
+      local start = C.get_time_ns()
+      for i = 1, occupancy do
+         k[0], k[1] = i, i
+         local t0 = C.get_time_ns()
+         ctab:add(k, v)
+         local t1 = C.get_time_ns()
+         local j = math.random(i)
+         k[0], k[1] = j, j
+         ctab:lookup_ptr(k)
+         local t2 = C.get_time_ns()
+         worst_add = math.max(worst_add, tonumber(t1 - t0))
+         worst_lookup = math.max(worst_lookup, tonumber(t2 - t1))
+      end
+      local elapsed = tonumber(C.get_time_ns() - start)
+      print(("growing to %s entries, %s: %.2f ns per add+lookup, "..
+             "worst case add %s ns, lookup %s ns"):format(
+            lib.comma_value(occupancy),
+            resize_step and 'resize_step='..resize_step or 'blocking resize',
+            elapsed / occupancy, lib.comma_value(worst_add),
+            lib.comma_value(worst_lookup)))
+   end
+   test_resize_latency(false)
+   test_resize_latency(16)
+   test_resize_latency(256)
+
+   -- Aging: lookups that touch entries, adds to a full table that evict
+   -- approximately-LRU or random entries, and incremental expiry.
+   local function test_aging(aging)
+      local size = 2^21
+      local ctab = ctable.new(
+         { key_type = ffi.typeof('uint32_t[2]'),
+           value_type = ffi.typeof('int32_t[5]'),
+           initial_size = size, max_size = size, aging = aging })
+      local k = ffi.new('uint32_t[2]');
+      local v = ffi.new('int32_t[5]');
+      local full = ctab.occupancy_hi
+      local what = aging and 'aging' or 'no aging'
+      local function add(first, count)
+         for i = first, first + count - 1 do
+            if i % 100 == 0 then ctab:set_time(i * 1e-5) end
+            k[0], k[1] = i, i
+            ctab:add(k, v)
+         end
+      end
+      test_perf(function (count) add(1, count) end, full,
+                'insertion up to '..lib.comma_value(full)..' entries, '..what)
+      test_perf(function (count)
+                   local result
+                   for i = 1, count do
+                      k[0], k[1] = i, i
+                      result = ctab:lookup_ptr(k)
+                   end
+                   return result
+                end, full, 'lookup_ptr, '..what)
+      test_perf(function (count) add(full + 1, count) end, full,
+                'insertion with eviction, '..what)
+      if aging then
+         local slots = ctab.size + ctab.max_displacement
+         test_perf(function (count) return ctab:expire(1e6, count) end,
+                   slots, 'expiry sweep, nothing expired')
+         test_perf(function (count) return ctab:expire(0, count) end,
+                   slots, 'expiry sweep, everything expired')
+      end
+   end
+   test_aging(false)
+   test_aging(true)
+
+   -- Scalar versus vectorized search along displacement chains, for 12-
+   -- and 36-byte keys (about the size of IPv4 and IPv6 flow keys), in
+   -- tables that fit in cache and tables that do not.
+   local function test_search(key_words, rate, size, vectorized)
+      local key_t = ffi.typeof('uint32_t[$]', key_words)
+      local ctab = ctable.new(
+         { key_type = key_t,
+           value_type = ffi.typeof('int32_t[5]'),
+           max_occupancy_rate = rate,
+           initial_size = math.ceil(size / rate),
+           vectorized_search = vectorized })
+      local k = key_t()
+      local v = ffi.new('int32_t[5]')
+      for i = 1, size do
+         for j = 0, key_words - 1 do k[j] = i end
+         ctab:add(k, v)
+      end
+      local what = ('%d-byte keys, %d%% occupancy, %s entries, %s'):format(
+         key_words * 4, rate * 100, lib.comma_value(size),
+         vectorized and 'vectorized' or 'scalar')
+      local function test_lookup_ptr(count)
+         local result
+         for i = 1, count do
+            local key = i % size + 1
+            for j = 0, key_words - 1 do k[j] = key end
+            result = ctab:lookup_ptr(k)
+         end
+         return result
+      end
+      local streamer = ctab:make_lookup_streamer(32)
+      local function test_lookup_streamer(count)
+         for i = 1, count, 32 do
+            for n = 0, 31 do
+               local key = (i + n) % size + 1
+               for j = 0, key_words - 1 do streamer.entries[n].key[j] = key end
+            end
+            streamer:stream()
+         end
+      end
+      test_perf(test_lookup_ptr, 2e6, 'lookup_ptr ('..what..')')
+      test_perf(test_lookup_streamer, 2e6,
+                'streaming lookup, stride=32 ('..what..')')
+   end
+   for _, key_words in ipairs({3, 9}) do
+      for _, rate in ipairs({0.4, 0.9}) do
+         for _, size in ipairs({2e4, 2e6}) do
+            test_search(key_words, rate, size, false)
+            if require('lib.linear_search').available then
+               test_search(key_words, rate, size, true)
+            end
+         end
+      end
+   end
+end
+
+function rangemap (nranges)
+   local rangemap = require("apps.lwaftr.rangemap")
+   local binary_search = require("lib.binary_search")
+   local band = require("bit").band
+   local sizes = {1e3, 64e3, 1e6}
+   if nranges then sizes = {assert(tonumber(nranges))} end
+   -- Random keys, more than fit in cache.
+   local nkeys = 2^20
+   local keys = ffi.new('uint32_t[?]', nkeys)
+   for i = 0, nkeys - 1 do keys[i] = math.random(0, 0xFFFFFFFF) end
+
+   for _, size in ipairs(sizes) do
+      -- Ranges spread over the whole key space, with gaps in between.
+      local builder = rangemap.RangeMapBuilder.new(ffi.typeof('uint32_t'))
+      local step = math.floor(2^32 / size)
+      for i = 0, size - 1 do
+         builder:add_range(i * step, i * step + math.floor(step / 2), i + 1)
+      end
+      local map = builder:build(0)
+      local entries = map.entries
+      print(('%d ranges (%d entries):'):format(size, map.size))
+
+      local function test_search(search, what)
+         test_perf(function (count)
+            local result
+            for i = 0, count - 1 do
+               result = search(entries, keys[band(i, nkeys - 1)]).value
+            end
+            return result
+         end, 1e7, what)
+      end
+      test_search(binary_search.gen(map.size, map.entry_type), 'binary search')
+      if binary_search.kary_available then
+         local tree = binary_search.kary_tree(entries, map.size,
+                                              map.entry_type)
+         test_search(binary_search.gen_kary(tree), 'k-ary search')
+         for _, width in ipairs({8, 32}) do
+            local search = binary_search.gen_kary_batch(tree, width)
+            local results = ffi.new(ffi.typeof('$*[?]', map.entry_type),
+                                    width)
+            test_perf(function (count)
+               for i = 0, count - 1, width do
+                  search(entries, keys + band(i, nkeys - 1), results)
+               end
+               return results[width - 1].value
+            end, 1e7, ('k-ary search (batches of %d)'):format(width))
+         end
+      else
+         print('k-ary search: not supported on this CPU')
+      end
+   end
+end
+
+function copy (size)
+   local multi_copy = require("lib.multi_copy")
+   local sizes = {16, 32, 48, 64, 96, 128, 256}
+   if size then sizes = {assert(tonumber(size))} end
+   local count, iterations = 32, 1e7
+   local data_offset = ffi.offsetof("struct packet", "data")
+   local batch = link.new_batch(count)
+   for i = 0, count - 1 do batch[i] = packet.allocate() end
+
+   for _, size in ipairs(sizes) do
+      assert(size % 4 == 0, "copy size must be a multiple of 4")
+      print(('%d bytes:'):format(size))
+      local src = ffi.new('uint8_t[?]', count * size)
+      local dst = ffi.new('uint8_t[?]', count * size)
+      local srcv = ffi.new('void*[?]', count)
+      for i = 0, count - 1 do srcv[i] = src + i * size end
+      test_perf(function (n)
+         for i = 1, n, count do
+            for j = 0, count - 1 do ffi.copy(dst + j * size, srcv[j], size) end
+         end
+         return dst[0]
+      end, iterations, 'ffi.copy')
+      for _, isa in ipairs({"sse", "avx2", "avx512"}) do
+         if multi_copy.isa_available[isa] then
+            local gathered = multi_copy.gen(count, size, isa)
+            test_perf(function (n)
+               for i = 1, n, count do gathered(dst, srcv) end
+               return dst[0]
+            end, iterations, 'multi_copy ('..isa..')')
+            local broadcast = multi_copy.gen_broadcast(size, data_offset, isa)
+            test_perf(function (n)
+               for i = 1, n, count do broadcast(batch, src, count) end
+               return batch[0].data[0]
+            end, iterations, 'broadcast into packets ('..isa..')')
+         end
+      end
+   end
+
+   for i = 0, count - 1 do packet.free(batch[i]) end
+end
+
+function link_batch (batch_size)
+   batch_size = tonumber(batch_size) or 64
+   assert(batch_size >= 1 and batch_size <= link.max, "Invalid batch size")
+   local iterations = 1e8
+   local r = link.new("snabbmark_batch")
+   local batch = link.new_batch(batch_size)
+   for i = 0, batch_size - 1 do
+      batch[i] = packet.allocate()
+      batch[i].length = 64
+   end
+
+   local function test_single(count)
+      local transmit, receive = link.transmit, link.receive
+      for i = 1, count, batch_size do
+         for j = 0, batch_size - 1 do transmit(r, batch[j]) end
+         for j = 0, batch_size - 1 do batch[j] = receive(r) end
+      end
+      return tonumber(counter.read(r.stats.rxbytes))
+   end
+
+   local function test_batch(count)
+      local transmit_batch, receive_batch =
+         link.transmit_batch, link.receive_batch
+      for i = 1, count, batch_size do
+         transmit_batch(r, batch, batch_size)
+         receive_batch(r, batch, batch_size)
+      end
+      return tonumber(counter.read(r.stats.rxbytes))
+   end
+
+   test_perf(test_single, iterations, 'transmit/receive (per packet)')
+   test_perf(test_batch, iterations,
+             'transmit_batch/receive_batch, batch='..batch_size)
+
+   for i = 0, batch_size - 1 do packet.free(batch[i]) end
+   link.free(r, "snabbmark_batch")
+end
+
+function imix (inflight)
+   inflight = tonumber(inflight) or 50000
+   local iterations = 2e7
+   -- Simple IMIX: 7 x 64, 4 x 576 and 1 x 1500 byte packets.
+   local sizes = {64, 64, 64, 64, 64, 64, 64, 576, 576, 576, 576, 1500}
+   local header_size = ffi.offsetof("struct packet", "data")
+   local ring = ffi.new("struct packet *[?]", inflight)
+   local data = ffi.new("uint8_t[?]", 1500)
+   ffi.fill(data, 1500, 1)
+
+   -- Keep inflight packets allocated (as if they were queued on links
+   -- and NIC rings), replacing the oldest one in each iteration.
+   local function test(sized)
+      return function (count)
+         local allocate, append, free = packet.allocate, packet.append, packet.free
+         local nsizes = #sizes
+         local sum = 0
+         for i = 0, count - 1 do
+            local slot = i % inflight
+            local p = ring[slot]
+            if p ~= nil then
+               sum = sum + p.data[p.length - 1]
+               free(p)
+            end
+            local len = sizes[i % nsizes + 1]
+            ring[slot] = append(allocate(sized and len or nil), data, len)
+         end
+         return sum
+      end
+   end
+
+   local function working_set()
+      local bytes = 0
+      for i = 0, inflight - 1 do
+         if ring[i] ~= nil then
+            bytes = bytes + header_size + ring[i].capacity
+            packet.free(ring[i])
+            ring[i] = nil
+         end
+      end
+      return bytes
+   end
+
+   for _, sized in ipairs({false, true}) do
+      local what = sized and 'allocate(size_hint)' or 'allocate()'
+      -- Warm up: fill the freelists before measuring.
+      test(sized)(inflight)
+      test_perf(test(sized), iterations, what)
+      print(("  working set of %d packets: %.1f MB"):format(
+            inflight, working_set() / 1e6))
+   end
+end
+
+-- Multi-process allocation stress: pairs of worker processes where one
+-- allocates packets and sends them over an interlink to the other,
+-- which frees them. Packets flow back to the senders only through the
+-- group freelist.
+function freelist (nworkers, duration)
+   nworkers = tonumber(nworkers) or 8
+   duration = tonumber(duration) or 10
+   assert(nworkers >= 2 and nworkers % 2 == 0, "Invalid number of workers")
+   local worker = require("core.worker")
+   local npairs = nworkers / 2
+   for i = 1, npairs do
+      local name = "snabbmark_freelist"..i
+      worker.start("source"..i, ([[
+         require("apps.interlink.test_source").start(%q)]]):format(name))
+      worker.start("sink"..i, ([[
+         require("program.snabbmark.snabbmark").freelist_sink(%q, %d)]])
+         :format(name, duration))
+   end
+   local function sinks_alive ()
+      local status = worker.status()
+      for i = 1, npairs do
+         if status["sink"..i].alive then return true end
+      end
+   end
+   while sinks_alive() do C.usleep(100000) end
+   local total = 0
+   for i = 1, npairs do
+      worker.stop("source"..i)
+      local rxpackets = counter.open(
+         "group/snabbmark_freelist"..i..".counter")
+      local mpps = tonumber(counter.read(rxpackets)) / duration / 1e6
+      print(("pair %d: %.2f Mpps"):format(i, mpps))
+      total = total + mpps
+   end
+   print(("%d workers: %.2f Mpps total"):format(nworkers, total))
+end
+
+function freelist_sink (name, duration)
+   local Receiver = require("apps.interlink.receiver")
+   local c = config.new()
+   config.app(c, name, Receiver)
+   config.app(c, "sink", basic_apps.Sink)
+   config.link(c, name..".output -> sink.input")
+   engine.configure(c)
+   engine.main({duration=duration, no_report=true})
+   local stats = link.stats(engine.app_table.sink.input.input)
+   counter.create("group/"..name..".counter", stats.rxpackets)
+   counter.commit()
+end
+
+-- Timing wheel with ntimers active timers: add them, reschedule and
+-- cancel some, and expire the rest.
+function timers (ntimers)
+   ntimers = tonumber(ntimers) or 10e6
+   local timer = require("core.timer")
+   local span = 2^20 -- Delays are spread over this many ticks
+   local wheel = timer.new_wheel({capacity=ntimers})
+   local ids = ffi.new("uint32_t[?]", ntimers)
+
+   test_perf(function (count)
+      local add, random = wheel.add, math.random
+      for i = 0, count - 1 do ids[i] = add(wheel, random(span), i) end
+      return wheel.count
+   end, ntimers, 'add')
+   test_perf(function (count)
+      local reschedule, random = wheel.reschedule, math.random
+      for i = 0, count - 1 do reschedule(wheel, ids[i], random(span)) end
+      return wheel.count
+   end, ntimers / 2, 'reschedule')
+   test_perf(function (count)
+      local cancel = wheel.cancel
+      for i = ntimers - count, ntimers - 1 do cancel(wheel, ids[i]) end
+      return wheel.count
+   end, ntimers / 10, 'cancel')
+   local nexpire = wheel.count
+   test_perf(function (count)
+      local expired = 0
+      wheel:advance(wheel.now + span, function (batch, n)
+         expired = expired + n
+      end)
+      return expired
+   end, nexpire, 'expire (batched)')
 end
@@ -90,6 +90,13 @@ function top (instance_pid)
          configs = current
          -- If a (new) config is loaded we (re)open the link counters.
          open_link_counters(counters, instance_tree)
+      elseif link_dwell_changed(counters, instance_tree) then
+         -- Dwell-time histograms come and go at runtime.
+         open_link_counters(counters, instance_tree)
+      end
+      -- App accounting counters are created on demand by the engine.
+      if app_counters_changed(counters, instance_tree) then
+         open_app_counters(counters, instance_tree)
       end
       local new_stats = get_stats(counters)
       if last_stats then
@@ -98,6 +105,8 @@ function top (instance_pid)
          io.write("\n")
          print_latency_metrics(new_stats, last_stats)
          print_link_metrics(new_stats, last_stats)
+         print_link_dwell_metrics(new_stats, last_stats)
+         print_app_metrics(new_stats, last_stats)
          io.flush()
       end
       last_stats = new_stats
@@ -109,6 +118,7 @@ function open_counters (tree)
    local counters = {}
    counters.engine = shm.open_frame(tree.."/engine")
    counters.links = {} -- These will be populated on demand.
+   counters.apps = {}
    return counters
 end
 
@@ -124,6 +134,36 @@ function open_link_counters (counters, tree)
    end
 end
 
+function link_dwell_changed (counters, tree)
+   for linkspec, link_frame in pairs(counters.links) do
+      local dwell = tree.."/links/"..linkspec.."/dwell.histogram"
+      if (link_frame.dwell ~= nil) ~= shm.exists(dwell) then return true end
+   end
+   return false
+end
+
+function app_counters_changed (counters, tree)
+   local apps, napps = shm.children(tree.."/engine/apps"), 0
+   for _ in pairs(counters.apps) do napps = napps + 1 end
+   if #apps ~= napps then return true end
+   for _, appname in ipairs(apps) do
+      if not counters.apps[appname] then return true end
+   end
+   return false
+end
+
+function open_app_counters (counters, tree)
+   -- Unmap and clear existing app accounting counters.
+   for _, app_frame in pairs(counters.apps) do
+      shm.delete_frame(app_frame)
+   end
+   counters.apps = {}
+   -- Open current app accounting counters.
+   for _, appname in ipairs(shm.children(tree.."/engine/apps")) do
+      counters.apps[appname] = shm.open_frame(tree.."/engine/apps/"..appname)
+   end
+end
+
 function get_stats (counters)
    local new_stats = {}
    for _, name in ipairs({"configs", "breaths", "frees", "freebytes"}) do
@@ -139,6 +179,16 @@ function get_stats (counters)
       in ipairs({"rxpackets", "txpackets", "rxbytes", "txbytes", "txdrop" }) do
          new_stats.links[linkspec][name] = counter.read(link[name])
       end
+      if link.dwell then
+         new_stats.links[linkspec].dwell = link.dwell:snapshot()
+      end
+   end
+   new_stats.apps = {}
+   for appname, app in pairs(counters.apps) do
+      new_stats.apps[appname] = {}
+      for _, name in ipairs({"cycles", "calls", "rxpackets", "txpackets"}) do
+         new_stats.apps[appname][name] = counter.read(app[name])
+      end
    end
    return new_stats
 end
@@ -168,6 +218,23 @@ function summarize_latency (histogram, prev)
    return min, cumulative / tonumber(total), max
 end
 
+-- Return the values below which the given fractions of the measurements
+-- recorded since prev fall, estimated as the midpoints of their buckets.
+function histogram_percentiles (histogram, prev, fractions)
+   local total = histogram.total
+   if prev then total = total - prev.total end
+   local ret, i, cumulative = {}, 1, 0
+   if total == 0 then return ret end
+   for count, lo, hi in histogram:iterate(prev) do
+      cumulative = cumulative + tonumber(count)
+      while i <= #fractions and cumulative >= fractions[i] * tonumber(total) do
+         ret[i] = hi < 1/0 and (lo + hi) / 2 or lo
+         i = i + 1
+      end
+   end
+   return ret
+end
+
 function print_latency_metrics (new_stats, last_stats)
    local cur, prev = new_stats.latency, last_stats.latency
    if not cur then return end
@@ -199,6 +266,63 @@ function print_link_metrics (new_stats, last_stats)
    end
 end
 
+local dwell_fractions = {0.5, 0.9, 0.99, 0.999}
+local link_dwell_metrics_row = {31, 9, 9, 9, 9}
+function print_link_dwell_metrics (new_stats, last_stats)
+   local linkspecs = {}
+   for linkspec, link in pairs(new_stats.links) do
+      local last = last_stats.links[linkspec]
+      if link.dwell and last and last.dwell then
+         table.insert(linkspecs, linkspec)
+      end
+   end
+   if #linkspecs == 0 then return end
+   table.sort(linkspecs)
+   print("\n")
+   print_row(link_dwell_metrics_row,
+             {"Link dwell time (Kcycles)", "p50", "p90", "p99", "p99.9"})
+   for _, linkspec in ipairs(linkspecs) do
+      local p = histogram_percentiles(new_stats.links[linkspec].dwell,
+                                      last_stats.links[linkspec].dwell,
+                                      dwell_fractions)
+      local row = {linkspec}
+      for i = 1, #dwell_fractions do
+         table.insert(row, p[i] and float_s(p[i] / 1e3) or "-")
+      end
+      print_row(link_dwell_metrics_row, row)
+   end
+end
+
+local app_metrics_row = {31, 9, 9, 9, 11, 10}
+function print_app_metrics (new_stats, last_stats)
+   if not next(new_stats.apps) then return end
+   print("\n")
+   print_row(app_metrics_row,
+             {"Apps (sampled breaths)", "calls", "rx/call", "tx/call",
+              "cycles/call", "cycles/pkt"})
+   local appnames = {}
+   for appname in pairs(new_stats.apps) do table.insert(appnames, appname) end
+   table.sort(appnames)
+   for _, appname in ipairs(appnames) do
+      local new, last = new_stats.apps[appname], last_stats.apps[appname]
+      if last then
+         local calls = tonumber(new.calls - last.calls)
+         local cycles = tonumber(new.cycles - last.cycles)
+         local rx = tonumber(new.rxpackets - last.rxpackets)
+         local tx = tonumber(new.txpackets - last.txpackets)
+         -- Apps that only transmit (e.g. pull from a NIC) are measured
+         -- per packet transmitted.
+         local packets = math.max(rx, tx)
+         print_row(app_metrics_row,
+                   {appname, tostring(calls),
+                    float_s(calls > 0 and rx / calls or 0),
+                    float_s(calls > 0 and tx / calls or 0),
+                    float_s(calls > 0 and cycles / calls or 0),
+                    float_s(packets > 0 and cycles / packets or 0)})
+      end
+   end
+end
+
 function pad_str (s, n, no_pad)
    local padding = math.max(n - s:len(), 0)
    return ("%s%s"):format(s:sub(1, n), (no_pad and "") or (" "):rep(padding))